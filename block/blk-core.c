@@ -3591,6 +3591,23 @@ EXPORT_SYMBOL(kblockd_mod_delayed_work_on);
  *   this kind of deadlock.
  */
 void blk_start_plug(struct blk_plug *plug)
+{
+	blk_start_plug_nr_ios(plug, 1);
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_start_plug_nr_ios - start a plug for a known batch of I/O
+ * @plug:	The &struct blk_plug that needs to be initialized
+ * @nr_ios:	Number of requests the caller expects to submit
+ *
+ * Description:
+ *   Like blk_start_plug(), but lets blk-mq allocate requests for up to
+ *   @nr_ios bios in one go the first time it needs one, and hand the rest
+ *   out from the plug.  Requests that end up unused are released when the
+ *   plug is flushed on schedule or finished.
+ */
+void blk_start_plug_nr_ios(struct blk_plug *plug, unsigned int nr_ios)
 {
 	struct task_struct *tsk = current;
 
@@ -3603,13 +3620,15 @@ void blk_start_plug(struct blk_plug *plug)
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
+	INIT_LIST_HEAD(&plug->cached_rqs);
+	plug->nr_ios = min_t(unsigned int, nr_ios, BLK_MAX_REQUEST_COUNT);
 	/*
 	 * Store ordering should not be needed here, since a potential
 	 * preempt will imply a full memory barrier
 	 */
 	tsk->plug = plug;
 }
-EXPORT_SYMBOL(blk_start_plug);
+EXPORT_SYMBOL(blk_start_plug_nr_ios);
 
 static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
 {
@@ -3695,6 +3714,13 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	if (!list_empty(&plug->mq_list))
 		blk_mq_flush_plug_list(plug, from_schedule);
 
+	/*
+	 * Cached requests pin tags and a queue reference, don't keep them
+	 * across a sleep.
+	 */
+	if (from_schedule && !list_empty(&plug->cached_rqs))
+		blk_mq_free_plug_rqs(plug);
+
 	if (list_empty(&plug->list))
 		return;
 
@@ -3751,6 +3777,8 @@ void blk_finish_plug(struct blk_plug *plug)
 	if (plug != current->plug)
 		return;
 	blk_flush_plug_list(plug, false);
+	if (!list_empty(&plug->cached_rqs))
+		blk_mq_free_plug_rqs(plug);
 
 	current->plug = NULL;
 }
@@ -248,12 +248,9 @@ bool blk_mq_sched_try_merge(struct request_queue *q, struct bio *bio,
 }
 EXPORT_SYMBOL_GPL(blk_mq_sched_try_merge);
 
-/*
- * Iterate list of requests and see if we can merge this bio with any
- * of them.
- */
-bool blk_mq_bio_list_merge(struct request_queue *q, struct list_head *list,
-			   struct bio *bio)
+static struct request *__blk_mq_bio_list_merge(struct request_queue *q,
+		struct list_head *list, struct bio *bio, bool front_merges,
+		enum elv_merge *type)
 {
 	struct request *rq;
 	int checked = 8;
@@ -267,12 +264,15 @@ bool blk_mq_bio_list_merge(struct request_queue *q, struct list_head *list,
 		if (!blk_rq_merge_ok(rq, bio))
 			continue;
 
-		switch (blk_try_merge(rq, bio)) {
+		*type = blk_try_merge(rq, bio);
+		switch (*type) {
 		case ELEVATOR_BACK_MERGE:
 			if (blk_mq_sched_allow_merge(q, rq, bio))
 				merged = bio_attempt_back_merge(q, rq, bio);
 			break;
 		case ELEVATOR_FRONT_MERGE:
+			if (!front_merges)
+				continue;
 			if (blk_mq_sched_allow_merge(q, rq, bio))
 				merged = bio_attempt_front_merge(q, rq, bio);
 			break;
@@ -283,13 +283,48 @@ bool blk_mq_bio_list_merge(struct request_queue *q, struct list_head *list,
 			continue;
 		}
 
-		return merged;
+		return merged ? rq : NULL;
 	}
 
-	return false;
+	return NULL;
+}
+
+/*
+ * Iterate list of requests and see if we can merge this bio with any
+ * of them.
+ */
+bool blk_mq_bio_list_merge(struct request_queue *q, struct list_head *list,
+			   struct bio *bio)
+{
+	enum elv_merge type;
+
+	return __blk_mq_bio_list_merge(q, list, bio, true, &type);
 }
 EXPORT_SYMBOL_GPL(blk_mq_bio_list_merge);
 
+/*
+ * Same as blk_mq_bio_list_merge(), for a list of requests that belong to
+ * the I/O scheduler and are not tracked by the elevator merge hash or
+ * q->last_merge.  The scheduler's request_merged hook is told about front
+ * merges, so it can reposition the request.
+ */
+bool blk_mq_sched_try_list_merge(struct request_queue *q,
+				 struct list_head *list, struct bio *bio,
+				 bool front_merges)
+{
+	struct elevator_queue *e = q->elevator;
+	enum elv_merge type;
+	struct request *rq;
+
+	rq = __blk_mq_bio_list_merge(q, list, bio, front_merges, &type);
+	if (!rq)
+		return false;
+	if (type == ELEVATOR_FRONT_MERGE && e->type->ops.mq.request_merged)
+		e->type->ops.mq.request_merged(q, rq, type);
+	return true;
+}
+EXPORT_SYMBOL_GPL(blk_mq_sched_try_list_merge);
+
 /*
  * Reverse check our software queue for entries that we could potentially
  * merge with. Currently includes a hand-wavy stop count of 8, to not spend
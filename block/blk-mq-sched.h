@@ -13,6 +13,9 @@ void blk_mq_sched_assign_ioc(struct request *rq, struct bio *bio);
 void blk_mq_sched_request_inserted(struct request *rq);
 bool blk_mq_sched_try_merge(struct request_queue *q, struct bio *bio,
 				struct request **merged_request);
+bool blk_mq_sched_try_list_merge(struct request_queue *q,
+				 struct list_head *list, struct bio *bio,
+				 bool front_merges);
 bool __blk_mq_sched_bio_merge(struct request_queue *q, struct bio *bio);
 bool blk_mq_sched_try_insert_merge(struct request_queue *q, struct request *rq);
 void blk_mq_sched_mark_restart_hctx(struct blk_mq_hw_ctx *hctx);
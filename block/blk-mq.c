@@ -396,6 +396,93 @@ static struct request *blk_mq_get_request(struct request_queue *q,
 	return rq;
 }
 
+/*
+ * Allocate the request for @bio together with up to plug->nr_ios - 1 more
+ * from the same hardware queue.  The queue reference, ctx and hctx lookup
+ * and tag_busy accounting are done once for the batch; the extra requests
+ * are parked on the plug for the bios that follow.
+ */
+static struct request *blk_mq_get_plug_batch(struct request_queue *q,
+		struct blk_plug *plug, struct bio *bio,
+		struct blk_mq_alloc_data *data)
+{
+	blk_mq_req_flags_t flags;
+	unsigned int nr = plug->nr_ios, i;
+	struct request *rq;
+
+	plug->nr_ios = 1;
+	rq = blk_mq_get_request(q, bio, bio->bi_opf, data);
+	if (!rq)
+		return NULL;
+
+	/* only take tags that are free right now, never wait for more */
+	flags = data->flags;
+	data->flags |= BLK_MQ_REQ_NOWAIT;
+	for (i = 1; i < nr; i++) {
+		struct request *next;
+		unsigned int tag;
+
+		tag = blk_mq_get_tag(data);
+		if (tag == BLK_MQ_TAG_FAIL)
+			break;
+		next = blk_mq_rq_ctx_init(data, tag, bio->bi_opf);
+		list_add_tail(&next->queuelist, &plug->cached_rqs);
+	}
+	data->flags = flags;
+
+	if (i > 1) {
+		percpu_ref_get_many(&q->q_usage_counter, i - 1);
+		data->hctx->queued += i - 1;
+	}
+	return rq;
+}
+
+/*
+ * Take a request preallocated by blk_mq_get_plug_batch().  The cache is
+ * only used while the task stays on the CPU that allocated it, so that the
+ * request's software queue still matches the submitting CPU.
+ */
+static struct request *blk_mq_get_plug_request(struct request_queue *q,
+		struct blk_plug *plug, struct bio *bio,
+		struct blk_mq_alloc_data *data)
+{
+	struct request *rq;
+
+	rq = list_first_entry(&plug->cached_rqs, struct request, queuelist);
+	if (rq->q != q || q->elevator)
+		return NULL;
+
+	data->ctx = blk_mq_get_ctx(q);
+	if (rq->mq_ctx != data->ctx) {
+		blk_mq_put_ctx(data->ctx);
+		data->ctx = NULL;
+		blk_mq_free_plug_rqs(plug);
+		return NULL;
+	}
+	data->q = q;
+	data->hctx = blk_mq_map_queue(q, data->ctx->cpu);
+
+	list_del_init(&rq->queuelist);
+	rq->cmd_flags = bio->bi_opf;
+	rq->start_time_ns = ktime_get_ns();
+	return rq;
+}
+
+/**
+ * blk_mq_free_plug_rqs - release requests cached on a plug
+ * @plug:	the plug whose unused requests should be returned
+ */
+void blk_mq_free_plug_rqs(struct blk_plug *plug)
+{
+	while (!list_empty(&plug->cached_rqs)) {
+		struct request *rq = list_first_entry(&plug->cached_rqs,
+						struct request, queuelist);
+
+		list_del_init(&rq->queuelist);
+		blk_mq_free_request(rq);
+	}
+}
+
 struct request *blk_mq_alloc_request(struct request_queue *q, unsigned int op,
 		blk_mq_req_flags_t flags)
 {
@@ -547,13 +634,6 @@ void blk_mq_end_request(struct request *rq, blk_status_t error)
 }
 EXPORT_SYMBOL(blk_mq_end_request);
 
-static void __blk_mq_complete_request_remote(void *data)
-{
-	struct request *rq = data;
-
-	rq->q->softirq_done_fn(rq);
-}
-
 static void __blk_mq_complete_request(struct request *rq)
 {
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
@@ -574,14 +654,9 @@ static void __blk_mq_complete_request(struct request *rq)
 	if (!test_bit(QUEUE_FLAG_SAME_FORCE, &rq->q->queue_flags))
 		shared = cpus_share_cache(cpu, ctx->cpu);
 
-	if (cpu != ctx->cpu && !shared && cpu_online(ctx->cpu)) {
-		rq->csd.func = __blk_mq_complete_request_remote;
-		rq->csd.info = rq;
-		rq->csd.flags = 0;
-		smp_call_function_single_async(ctx->cpu, &rq->csd);
-	} else {
+	if (cpu == ctx->cpu || shared ||
+	    !blk_complete_request_on(ctx->cpu, rq))
 		rq->q->softirq_done_fn(rq);
-	}
 	put_cpu();
 }
 
@@ -1820,7 +1895,7 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	const int is_sync = op_is_sync(bio->bi_opf);
 	const int is_flush_fua = op_is_flush(bio->bi_opf);
 	struct blk_mq_alloc_data data = { .flags = 0 };
-	struct request *rq;
+	struct request *rq = NULL;
 	unsigned int request_count = 0;
 	struct blk_plug *plug;
 	struct request *same_queue_rq = NULL;
@@ -1844,7 +1919,15 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 
 	trace_block_getrq(q, bio, bio->bi_opf);
 
-	rq = blk_mq_get_request(q, bio, bio->bi_opf, &data);
+	plug = current->plug;
+	if (plug && !list_empty(&plug->cached_rqs))
+		rq = blk_mq_get_plug_request(q, plug, bio, &data);
+	if (!rq) {
+		if (plug && plug->nr_ios > 1 && !q->elevator)
+			rq = blk_mq_get_plug_batch(q, plug, bio, &data);
+		else
+			rq = blk_mq_get_request(q, bio, bio->bi_opf, &data);
+	}
 	if (unlikely(!rq)) {
 		rq_qos_cleanup(q, bio);
 		if (bio->bi_opf & REQ_NOWAIT)
@@ -1856,7 +1939,6 @@ static blk_qc_t blk_mq_make_request(struct request_queue *q, struct bio *bio)
 
 	cookie = request_to_qc_t(data.hctx, rq);
 
-	plug = current->plug;
 	if (unlikely(is_flush_fua)) {
 		blk_mq_put_ctx(data.ctx);
 		blk_mq_bio_to_request(rq, bio);
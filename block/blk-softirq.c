@@ -16,6 +16,23 @@
 
 static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
 
+/*
+ * Requests completed on behalf of another CPU are collected on that CPU's
+ * blk_cpu_remote list.  Only the request that finds the list empty sends
+ * an IPI, so a burst of completions for one CPU costs a single IPI and a
+ * single softirq run there instead of an IPI per request.
+ *
+ * The IPI uses a per-CPU csd rather than one embedded in a request, as a
+ * request may be completed and reused before its IPI has been handled.
+ * blk_cpu_remote_kicked is set while that csd is in flight, so it is never
+ * sent twice when the softirq drained the list ahead of the IPI.
+ */
+static DEFINE_PER_CPU(struct llist_head, blk_cpu_remote);
+#ifdef CONFIG_SMP
+static DEFINE_PER_CPU(call_single_data_t, blk_cpu_remote_csd);
+static DEFINE_PER_CPU(unsigned long, blk_cpu_remote_kicked);
+#endif
+
 /*
  * Softirq action handler - move entries to local list and loop over them
  * while passing them to the queue registered handler.
@@ -23,6 +40,8 @@ static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
 static __latent_entropy void blk_done_softirq(struct softirq_action *h)
 {
 	struct list_head *cpu_list, local_list;
+	struct llist_node *remote;
+	struct request *rq, *next;
 
 	local_irq_disable();
 	cpu_list = this_cpu_ptr(&blk_cpu_done);
@@ -30,58 +49,56 @@ static __latent_entropy void blk_done_softirq(struct softirq_action *h)
 	local_irq_enable();
 
 	while (!list_empty(&local_list)) {
-		struct request *rq;
-
 		rq = list_entry(local_list.next, struct request, ipi_list);
 		list_del_init(&rq->ipi_list);
 		rq->q->softirq_done_fn(rq);
 	}
+
+	remote = llist_del_all(this_cpu_ptr(&blk_cpu_remote));
+	remote = llist_reverse_order(remote);
+	llist_for_each_entry_safe(rq, next, remote, ipi_llist)
+		rq->q->softirq_done_fn(rq);
 }
 
 #ifdef CONFIG_SMP
-static void trigger_softirq(void *data)
+static void blk_remote_done_ipi(void *data)
 {
-	struct request *rq = data;
-	unsigned long flags;
-	struct list_head *list;
-
-	local_irq_save(flags);
-	list = this_cpu_ptr(&blk_cpu_done);
-	list_add_tail(&rq->ipi_list, list);
-
-	if (list->next == &rq->ipi_list)
-		raise_softirq_irqoff(BLOCK_SOFTIRQ);
-
-	local_irq_restore(flags);
+	/* the csd is unlocked already, let the next completion kick again */
+	clear_bit(0, this_cpu_ptr(&blk_cpu_remote_kicked));
+	raise_softirq_irqoff(BLOCK_SOFTIRQ);
 }
 
-/*
- * Setup and invoke a run of 'trigger_softirq' on the given cpu.
+/**
+ * blk_complete_request_on - complete a request in softirq context on @cpu
+ * @cpu:	the CPU that should run the completion
+ * @rq:		the request being completed
+ *
+ * Must be called with preemption disabled.  Returns false if @cpu is
+ * offline, in which case the caller has to complete @rq itself.
  */
-static int raise_blk_irq(int cpu, struct request *rq)
+bool blk_complete_request_on(int cpu, struct request *rq)
 {
-	if (cpu_online(cpu)) {
-		call_single_data_t *data = &rq->csd;
-
-		data->func = trigger_softirq;
-		data->info = rq;
-		data->flags = 0;
-
-		smp_call_function_single_async(cpu, data);
-		return 0;
-	}
-
-	return 1;
+	if (!cpu_online(cpu))
+		return false;
+
+	if (llist_add(&rq->ipi_llist, &per_cpu(blk_cpu_remote, cpu)) &&
+	    !test_and_set_bit(0, &per_cpu(blk_cpu_remote_kicked, cpu)))
+		smp_call_function_single_async(cpu,
+					       &per_cpu(blk_cpu_remote_csd, cpu));
+	return true;
 }
 #else /* CONFIG_SMP */
-static int raise_blk_irq(int cpu, struct request *rq)
+bool blk_complete_request_on(int cpu, struct request *rq)
 {
-	return 1;
+	return false;
 }
 #endif
 
 static int blk_softirq_cpu_dead(unsigned int cpu)
 {
+	struct llist_node *remote;
+	struct request *rq, *next;
+
 	/*
 	 * If a CPU goes away, splice its entries to the current CPU
 	 * and trigger a run of the softirq
@@ -89,6 +106,13 @@ static int blk_softirq_cpu_dead(unsigned int cpu)
 	local_irq_disable();
 	list_splice_init(&per_cpu(blk_cpu_done, cpu),
 			 this_cpu_ptr(&blk_cpu_done));
+	remote = llist_del_all(&per_cpu(blk_cpu_remote, cpu));
+	remote = llist_reverse_order(remote);
+	llist_for_each_entry_safe(rq, next, remote, ipi_llist)
+		list_add_tail(&rq->ipi_list, this_cpu_ptr(&blk_cpu_done));
+#ifdef CONFIG_SMP
+	clear_bit(0, &per_cpu(blk_cpu_remote_kicked, cpu));
+#endif
 	raise_softirq_irqoff(BLOCK_SOFTIRQ);
 	local_irq_enable();
 
@@ -139,7 +163,7 @@ void __blk_complete_request(struct request *req)
 		 */
 		if (list->next == &req->ipi_list)
 			raise_softirq_irqoff(BLOCK_SOFTIRQ);
-	} else if (raise_blk_irq(ccpu, req))
+	} else if (!blk_complete_request_on(ccpu, req))
 		goto do_local;
 
 	local_irq_restore(flags);
@@ -170,8 +194,13 @@ static __init int blk_softirq_init(void)
 {
 	int i;
 
-	for_each_possible_cpu(i)
+	for_each_possible_cpu(i) {
 		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+		init_llist_head(&per_cpu(blk_cpu_remote, i));
+#ifdef CONFIG_SMP
+		per_cpu(blk_cpu_remote_csd, i).func = blk_remote_done_ipi;
+#endif
+	}
 
 	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq);
 	cpuhp_setup_state_nocalls(CPUHP_BLOCK_SOFTIRQ_DEAD,
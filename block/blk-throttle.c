@@ -35,6 +35,13 @@ static int throtl_quantum = 32;
  * help determine if its IO is impacted by others, hence we ignore the IO
  */
 #define LATENCY_FILTERED_HD (1000L) /* 1ms */
+/*
+ * A token cache refill takes at most 1/THROTL_TOKEN_ROOM_DIV of what is left
+ * of the slice and 1/THROTL_TOKEN_SLICE_DIV of a full slice, which bounds the
+ * budget that can be stranded on CPUs that stop issuing IO.
+ */
+#define THROTL_TOKEN_ROOM_DIV (4)
+#define THROTL_TOKEN_SLICE_DIV (8)
 
 static struct blkcg_policy blkcg_policy_throtl;
 
@@ -91,6 +98,19 @@ struct throtl_service_queue {
 	struct timer_list	pending_timer;	/* fires on first_pending_disptime */
 };
 
+/*
+ * Per-cpu cache of dispatch budget already charged to a throtl_grp.  While
+ * ->gen matches the group's token_gen and ->expires hasn't passed, bios can
+ * be dispatched from the cache without taking queue_lock.  U64_MAX bytes or
+ * UINT_MAX ios mean that direction has no bps or iops limit.
+ */
+struct throtl_tokens {
+	u64			bytes[2];
+	unsigned int		ios[2];
+	unsigned int		gen[2];
+	unsigned long		expires[2];
+};
+
 enum tg_state_flags {
 	THROTL_TG_PENDING	= 1 << 0,	/* on parent's pending tree */
 	THROTL_TG_WAS_EMPTY	= 1 << 1,	/* bio_lists[] became non-empty */
@@ -177,6 +197,10 @@ struct throtl_grp {
 	unsigned int bio_cnt; /* total bios */
 	unsigned int bad_bio_cnt; /* bios exceeding latency threshold */
 	unsigned long bio_cnt_reset_time;
+
+	/* per-cpu dispatch budget, invalidated by bumping token_gen[] */
+	struct throtl_tokens __percpu *tokens;
+	unsigned int token_gen[2];
 };
 
 /* We measure latency for request size from <= 4k to >= 1M */
@@ -387,6 +411,16 @@ static inline unsigned int throtl_bio_data_size(struct bio *bio)
 	return bio->bi_iter.bi_size;
 }
 
+/*
+ * Drop whatever budget the per-cpu caches of @tg hold for @rw.  Called with
+ * queue_lock held whenever the charged budget stops matching the slice, the
+ * limits change or bios get queued to @tg.
+ */
+static inline void tg_invalidate_tokens(struct throtl_grp *tg, bool rw)
+{
+	WRITE_ONCE(tg->token_gen[rw], tg->token_gen[rw] + 1);
+}
+
 static void throtl_qnode_init(struct throtl_qnode *qn, struct throtl_grp *tg)
 {
 	INIT_LIST_HEAD(&qn->node);
@@ -488,6 +522,12 @@ static struct blkg_policy_data *throtl_pd_alloc(gfp_t gfp, int node)
 	if (!tg)
 		return NULL;
 
+	tg->tokens = alloc_percpu_gfp(struct throtl_tokens, gfp);
+	if (!tg->tokens) {
+		kfree(tg);
+		return NULL;
+	}
+
 	throtl_service_queue_init(&tg->service_queue);
 
 	for (rw = READ; rw <= WRITE; rw++) {
@@ -598,6 +638,8 @@ static void throtl_pd_offline(struct blkg_policy_data *pd)
 	tg->bps[WRITE][LIMIT_LOW] = 0;
 	tg->iops[READ][LIMIT_LOW] = 0;
 	tg->iops[WRITE][LIMIT_LOW] = 0;
+	tg_invalidate_tokens(tg, READ);
+	tg_invalidate_tokens(tg, WRITE);
 
 	blk_throtl_update_limit_valid(tg->td);
 
@@ -610,6 +652,7 @@ static void throtl_pd_free(struct blkg_policy_data *pd)
 	struct throtl_grp *tg = pd_to_tg(pd);
 
 	del_timer_sync(&tg->service_queue.pending_timer);
+	free_percpu(tg->tokens);
 	kfree(tg);
 }
 
@@ -770,6 +813,7 @@ static inline void throtl_start_new_slice_with_credit(struct throtl_grp *tg,
 {
 	tg->bytes_disp[rw] = 0;
 	tg->io_disp[rw] = 0;
+	tg_invalidate_tokens(tg, rw);
 
 	/*
 	 * Previous slice has expired. We must have trimmed it after last
@@ -791,6 +835,7 @@ static inline void throtl_start_new_slice(struct throtl_grp *tg, bool rw)
 {
 	tg->bytes_disp[rw] = 0;
 	tg->io_disp[rw] = 0;
+	tg_invalidate_tokens(tg, rw);
 	tg->slice_start[rw] = jiffies;
 	tg->slice_end[rw] = jiffies + tg->td->throtl_slice;
 	throtl_log(&tg->service_queue,
@@ -1054,6 +1099,126 @@ static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
 		bio_set_flag(bio, BIO_THROTTLED);
 }
 
+/*
+ * Token caches are only used for groups whose own limits are the only ones
+ * that apply, i.e. none of the ancestors has rules, and only while no .low
+ * limit is configured as the upgrade/downgrade logic looks at every bio.
+ */
+static bool tg_may_cache_tokens(struct throtl_grp *tg, bool rw)
+{
+	struct throtl_grp *parent_tg = sq_to_tg(tg->service_queue.parent_sq);
+	struct throtl_data *td = tg->td;
+
+	if (td->limit_valid[LIMIT_LOW] || td->limit_index != LIMIT_MAX)
+		return false;
+	if (parent_tg && parent_tg->has_rules[rw])
+		return false;
+	return !tg->service_queue.nr_queued[rw];
+}
+
+/*
+ * Charge a batch of the budget left in @tg's current slice up front and
+ * hand it to this CPU's token cache.  Called with queue_lock held right
+ * after a bio was dispatched directly from @tg.
+ */
+static void tg_refill_tokens(struct throtl_grp *tg, bool rw)
+{
+	struct throtl_tokens *tc = this_cpu_ptr(tg->tokens);
+	unsigned long jiffy_elapsed_rnd;
+	u64 bps = tg_bps_limit(tg, rw);
+	unsigned int iops = tg_iops_limit(tg, rw);
+	u64 bytes = U64_MAX, tmp;
+	unsigned int ios = UINT_MAX;
+
+	if (!tg_may_cache_tokens(tg, rw))
+		return;
+
+	jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+	if (!jiffy_elapsed_rnd)
+		jiffy_elapsed_rnd = tg->td->throtl_slice;
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, tg->td->throtl_slice);
+
+	if (bps != U64_MAX) {
+		tmp = bps * jiffy_elapsed_rnd;
+		do_div(tmp, HZ);
+		if (tmp <= tg->bytes_disp[rw])
+			return;
+		bytes = div_u64(tmp - tg->bytes_disp[rw],
+				THROTL_TOKEN_ROOM_DIV);
+		tmp = bps * tg->td->throtl_slice;
+		do_div(tmp, HZ * THROTL_TOKEN_SLICE_DIV);
+		bytes = min(bytes, tmp);
+		if (!bytes)
+			return;
+	}
+
+	if (iops != UINT_MAX) {
+		tmp = (u64)iops * jiffy_elapsed_rnd;
+		do_div(tmp, HZ);
+		if (tmp <= tg->io_disp[rw])
+			return;
+		tmp = div_u64(tmp - tg->io_disp[rw], THROTL_TOKEN_ROOM_DIV);
+		ios = min_t(u64, tmp,
+			    div_u64((u64)iops * tg->td->throtl_slice,
+				    HZ * THROTL_TOKEN_SLICE_DIV));
+		if (!ios)
+			return;
+	}
+
+	/* the cache's leftover was charged already, keep it if still valid */
+	if (tc->gen[rw] != tg->token_gen[rw] ||
+	    time_after_eq(jiffies, tc->expires[rw])) {
+		tc->bytes[rw] = 0;
+		tc->ios[rw] = 0;
+		tc->gen[rw] = tg->token_gen[rw];
+	}
+
+	if (bytes != U64_MAX) {
+		tg->bytes_disp[rw] += bytes;
+		tc->bytes[rw] += bytes;
+	} else {
+		tc->bytes[rw] = U64_MAX;
+	}
+	if (ios != UINT_MAX) {
+		tg->io_disp[rw] += ios;
+		tc->ios[rw] += ios;
+	} else {
+		tc->ios[rw] = UINT_MAX;
+	}
+	tc->expires[rw] = tg->slice_end[rw];
+
+	throtl_log(&tg->service_queue, "[%c] refill tokens bytes=%llu ios=%u",
+		   rw == READ ? 'R' : 'W', bytes, ios);
+}
+
+/*
+ * Try to dispatch @bio from this CPU's token cache without queue_lock.
+ * Invalidation is only ordered by queue_lock on the refill side, so a bio
+ * racing with it may still consume budget that was charged before.
+ */
+static bool tg_consume_tokens(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned int bio_size = throtl_bio_data_size(bio);
+	struct throtl_tokens *tc;
+	unsigned long flags;
+	bool ret = false;
+
+	local_irq_save(flags);
+	tc = this_cpu_ptr(tg->tokens);
+	if (tc->gen[rw] == READ_ONCE(tg->token_gen[rw]) &&
+	    time_before(jiffies, tc->expires[rw]) &&
+	    tc->ios[rw] && tc->bytes[rw] >= bio_size) {
+		if (tc->bytes[rw] != U64_MAX)
+			tc->bytes[rw] -= bio_size;
+		if (tc->ios[rw] != UINT_MAX)
+			tc->ios[rw]--;
+		ret = true;
+	}
+	local_irq_restore(flags);
+	return ret;
+}
+
 /**
  * throtl_add_bio_tg - add a bio to the specified throtl_grp
  * @bio: bio to add
@@ -1081,6 +1246,9 @@ static void throtl_add_bio_tg(struct bio *bio, struct throtl_qnode *qn,
 	if (!sq->nr_queued[rw])
 		tg->flags |= THROTL_TG_WAS_EMPTY;
 
+	/* throtl is FIFO, later bios must not overtake @bio from the cache */
+	tg_invalidate_tokens(tg, rw);
+
 	throtl_qnode_add_bio(bio, qn, &sq->queued[rw]);
 
 	sq->nr_queued[rw]++;
@@ -1399,6 +1567,8 @@ static void tg_conf_updated(struct throtl_grp *tg, bool global)
 		struct throtl_grp *parent_tg;
 
 		tg_update_has_rules(this_tg);
+		tg_invalidate_tokens(this_tg, READ);
+		tg_invalidate_tokens(this_tg, WRITE);
 		/* ignore root/second level */
 		if (!cgroup_subsys_on_dfl(io_cgrp_subsys) || !blkg->parent ||
 		    !blkg->parent->parent)
@@ -2141,6 +2311,7 @@ bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg,
 {
 	struct throtl_qnode *qn = NULL;
 	struct throtl_grp *tg = blkg_to_tg(blkg ?: q->root_blkg);
+	struct throtl_grp *bio_tg = tg;
 	struct throtl_service_queue *sq;
 	bool rw = bio_data_dir(bio);
 	bool throttled = false;
@@ -2152,6 +2323,12 @@ bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg,
 	if (bio_flagged(bio, BIO_THROTTLED) || !tg->has_rules[rw])
 		goto out;
 
+	/* budget already charged to @tg on this CPU, skip queue_lock */
+	if (!blk_queue_bypass(q) && tg_consume_tokens(tg, bio)) {
+		blk_throtl_assoc_bio(tg, bio);
+		goto out;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	throtl_update_latency_buckets(td);
@@ -2199,6 +2376,8 @@ bool blk_throtl_bio(struct request_queue *q, struct blkcg_gq *blkg,
 		 * So keep on trimming slice even if bio is not queued.
 		 */
 		throtl_trim_slice(tg, rw);
+		if (tg == bio_tg)
+			tg_refill_tokens(tg, rw);
 
 		/*
 		 * @bio passed through this layer without being throttled.
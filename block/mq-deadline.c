@@ -32,10 +32,14 @@ static const int writes_starved = 2;    /* max times reads can starve a write */
 static const int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
 
-struct deadline_data {
-	/*
-	 * run time data
-	 */
+/*
+ * Scheduling state.  A queue with a single hardware queue (or a zoned
+ * one) has one shard shared by every hardware context; otherwise each
+ * hardware context gets its own shard and lock, so submitters and
+ * dispatchers on different hardware queues don't contend.
+ */
+struct dd_shard {
+	spinlock_t lock;
 
 	/*
 	 * requests (deadline_rq s) are present on both sort_list and fifo_list
@@ -50,6 +54,17 @@ struct deadline_data {
 	unsigned int batching;		/* number of sequential requests made */
 	unsigned int starved;		/* times reads have starved writes */
 
+	struct list_head dispatch;
+
+	/*
+	 * earliest fifo_time on the fifo lists, for the expiry check of
+	 * the other shards.  Only maintained for sharded queues.
+	 */
+	unsigned long expire;
+	bool expire_set;
+} ____cacheline_aligned_in_smp;
+
+struct deadline_data {
 	/*
 	 * settings that change how the i/o scheduler behaves
 	 */
@@ -58,15 +73,22 @@ struct deadline_data {
 	int writes_starved;
 	int front_merges;
 
-	spinlock_t lock;
+	bool sharded;
+	unsigned long next_expire_scan;
+
 	spinlock_t zone_lock;
-	struct list_head dispatch;
+	struct dd_shard shard;		/* used when !sharded */
 };
 
+static inline struct dd_shard *dd_rq_shard(struct request *rq)
+{
+	return blk_mq_map_queue(rq->q, rq->mq_ctx->cpu)->sched_data;
+}
+
 static inline struct rb_root *
-deadline_rb_root(struct deadline_data *dd, struct request *rq)
+deadline_rb_root(struct dd_shard *ds, struct request *rq)
 {
-	return &dd->sort_list[rq_data_dir(rq)];
+	return &ds->sort_list[rq_data_dir(rq)];
 }
 
 /*
@@ -84,22 +106,22 @@ deadline_latter_request(struct request *rq)
 }
 
 static void
-deadline_add_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_add_rq_rb(struct dd_shard *ds, struct request *rq)
 {
-	struct rb_root *root = deadline_rb_root(dd, rq);
+	struct rb_root *root = deadline_rb_root(ds, rq);
 
 	elv_rb_add(root, rq);
 }
 
 static inline void
-deadline_del_rq_rb(struct deadline_data *dd, struct request *rq)
+deadline_del_rq_rb(struct dd_shard *ds, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	if (dd->next_rq[data_dir] == rq)
-		dd->next_rq[data_dir] = deadline_latter_request(rq);
+	if (ds->next_rq[data_dir] == rq)
+		ds->next_rq[data_dir] = deadline_latter_request(rq);
 
-	elv_rb_del(deadline_rb_root(dd, rq), rq);
+	elv_rb_del(deadline_rb_root(ds, rq), rq);
 }
 
 /*
@@ -115,7 +137,11 @@ static void deadline_remove_request(struct request_queue *q, struct request *rq)
 	 * We might not be on the rbtree, if we are doing an insert merge
 	 */
 	if (!RB_EMPTY_NODE(&rq->rb_node))
-		deadline_del_rq_rb(dd, rq);
+		deadline_del_rq_rb(dd_rq_shard(rq), rq);
+
+	/* sharded queues never use the queue-wide merge hash */
+	if (dd->sharded)
+		return;
 
 	elv_rqhash_del(q, rq);
 	if (q->last_merge == rq)
@@ -125,14 +151,14 @@ static void deadline_remove_request(struct request_queue *q, struct request *rq)
 static void dd_request_merged(struct request_queue *q, struct request *req,
 			      enum elv_merge type)
 {
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = dd_rq_shard(req);
 
 	/*
 	 * if the merge was a front merge, we need to reposition request
 	 */
 	if (type == ELEVATOR_FRONT_MERGE) {
-		elv_rb_del(deadline_rb_root(dd, req), req);
-		deadline_add_rq_rb(dd, req);
+		elv_rb_del(deadline_rb_root(ds, req), req);
+		deadline_add_rq_rb(ds, req);
 	}
 }
 
@@ -161,13 +187,13 @@ static void dd_merged_requests(struct request_queue *q, struct request *req,
  * move an entry to dispatch queue
  */
 static void
-deadline_move_request(struct deadline_data *dd, struct request *rq)
+deadline_move_request(struct dd_shard *ds, struct request *rq)
 {
 	const int data_dir = rq_data_dir(rq);
 
-	dd->next_rq[READ] = NULL;
-	dd->next_rq[WRITE] = NULL;
-	dd->next_rq[data_dir] = deadline_latter_request(rq);
+	ds->next_rq[READ] = NULL;
+	ds->next_rq[WRITE] = NULL;
+	ds->next_rq[data_dir] = deadline_latter_request(rq);
 
 	/*
 	 * take it off the sort and fifo list
@@ -177,11 +203,11 @@ deadline_move_request(struct deadline_data *dd, struct request *rq)
 
 /*
  * deadline_check_fifo returns 0 if there are no expired requests on the fifo,
- * 1 otherwise. Requires !list_empty(&dd->fifo_list[data_dir])
+ * 1 otherwise. Requires !list_empty(&ds->fifo_list[data_dir])
  */
-static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
+static inline int deadline_check_fifo(struct dd_shard *ds, int ddir)
 {
-	struct request *rq = rq_entry_fifo(dd->fifo_list[ddir].next);
+	struct request *rq = rq_entry_fifo(ds->fifo_list[ddir].next);
 
 	/*
 	 * rq is expired!
@@ -197,7 +223,8 @@ static inline int deadline_check_fifo(struct deadline_data *dd, int ddir)
  * dispatch using arrival ordered lists.
  */
 static struct request *
-deadline_fifo_request(struct deadline_data *dd, int data_dir)
+deadline_fifo_request(struct deadline_data *dd, struct dd_shard *ds,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -205,10 +232,10 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	if (list_empty(&dd->fifo_list[data_dir]))
+	if (list_empty(&ds->fifo_list[data_dir]))
 		return NULL;
 
-	rq = rq_entry_fifo(dd->fifo_list[data_dir].next);
+	rq = rq_entry_fifo(ds->fifo_list[data_dir].next);
 	if (data_dir == READ || !blk_queue_is_zoned(rq->q))
 		return rq;
 
@@ -217,7 +244,7 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
 	 * an unlocked target zone.
 	 */
 	spin_lock_irqsave(&dd->zone_lock, flags);
-	list_for_each_entry(rq, &dd->fifo_list[WRITE], queuelist) {
+	list_for_each_entry(rq, &ds->fifo_list[WRITE], queuelist) {
 		if (blk_req_can_dispatch_to_zone(rq))
 			goto out;
 	}
@@ -233,7 +260,8 @@ deadline_fifo_request(struct deadline_data *dd, int data_dir)
  * dispatch using sector position sorted lists.
  */
 static struct request *
-deadline_next_request(struct deadline_data *dd, int data_dir)
+deadline_next_request(struct deadline_data *dd, struct dd_shard *ds,
+		      int data_dir)
 {
 	struct request *rq;
 	unsigned long flags;
@@ -241,7 +269,7 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
 	if (WARN_ON_ONCE(data_dir != READ && data_dir != WRITE))
 		return NULL;
 
-	rq = dd->next_rq[data_dir];
+	rq = ds->next_rq[data_dir];
 	if (!rq)
 		return NULL;
 
@@ -267,29 +295,30 @@ deadline_next_request(struct deadline_data *dd, int data_dir)
  * deadline_dispatch_requests selects the best request according to
  * read/write expire, fifo_batch, etc
  */
-static struct request *__dd_dispatch_request(struct deadline_data *dd)
+static struct request *__dd_dispatch_request(struct deadline_data *dd,
+					      struct dd_shard *ds)
 {
 	struct request *rq, *next_rq;
 	bool reads, writes;
 	int data_dir;
 
-	if (!list_empty(&dd->dispatch)) {
-		rq = list_first_entry(&dd->dispatch, struct request, queuelist);
+	if (!list_empty(&ds->dispatch)) {
+		rq = list_first_entry(&ds->dispatch, struct request, queuelist);
 		list_del_init(&rq->queuelist);
 		goto done;
 	}
 
-	reads = !list_empty(&dd->fifo_list[READ]);
-	writes = !list_empty(&dd->fifo_list[WRITE]);
+	reads = !list_empty(&ds->fifo_list[READ]);
+	writes = !list_empty(&ds->fifo_list[WRITE]);
 
 	/*
 	 * batches are currently reads XOR writes
 	 */
-	rq = deadline_next_request(dd, WRITE);
+	rq = deadline_next_request(dd, ds, WRITE);
 	if (!rq)
-		rq = deadline_next_request(dd, READ);
+		rq = deadline_next_request(dd, ds, READ);
 
-	if (rq && dd->batching < dd->fifo_batch)
+	if (rq && ds->batching < dd->fifo_batch)
 		/* we have a next request are still entitled to batch */
 		goto dispatch_request;
 
@@ -299,10 +328,10 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	 */
 
 	if (reads) {
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[READ]));
+		BUG_ON(RB_EMPTY_ROOT(&ds->sort_list[READ]));
 
-		if (deadline_fifo_request(dd, WRITE) &&
-		    (dd->starved++ >= dd->writes_starved))
+		if (deadline_fifo_request(dd, ds, WRITE) &&
+		    (ds->starved++ >= dd->writes_starved))
 			goto dispatch_writes;
 
 		data_dir = READ;
@@ -316,9 +345,9 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 
 	if (writes) {
 dispatch_writes:
-		BUG_ON(RB_EMPTY_ROOT(&dd->sort_list[WRITE]));
+		BUG_ON(RB_EMPTY_ROOT(&ds->sort_list[WRITE]));
 
-		dd->starved = 0;
+		ds->starved = 0;
 
 		data_dir = WRITE;
 
@@ -331,14 +360,14 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
-	next_rq = deadline_next_request(dd, data_dir);
-	if (deadline_check_fifo(dd, data_dir) || !next_rq) {
+	next_rq = deadline_next_request(dd, ds, data_dir);
+	if (deadline_check_fifo(ds, data_dir) || !next_rq) {
 		/*
 		 * A deadline has expired, the last request was in the other
 		 * direction, or we have run out of higher-sectored requests.
 		 * Start again from the request with the earliest expiry time.
 		 */
-		rq = deadline_fifo_request(dd, data_dir);
+		rq = deadline_fifo_request(dd, ds, data_dir);
 	} else {
 		/*
 		 * The last req was the same dir and we have a next request in
@@ -354,14 +383,14 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	if (!rq)
 		return NULL;
 
-	dd->batching = 0;
+	ds->batching = 0;
 
 dispatch_request:
 	/*
 	 * rq is the selected appropriate request.
 	 */
-	dd->batching++;
-	deadline_move_request(dd, rq);
+	ds->batching++;
+	deadline_move_request(ds, rq);
 done:
 	/*
 	 * If the request needs its target zone locked, do it.
@@ -371,11 +400,125 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 	return rq;
 }
 
+/*
+ * Record the earliest expiry time of the shard, so that other hardware
+ * queues can check it without taking the shard lock.
+ */
+static void dd_update_expire(struct dd_shard *ds)
+{
+	unsigned long expire = 0;
+	bool expire_set = false;
+	int ddir;
+
+	for (ddir = READ; ddir <= WRITE; ddir++) {
+		struct request *rq;
+
+		if (list_empty(&ds->fifo_list[ddir]))
+			continue;
+		rq = rq_entry_fifo(ds->fifo_list[ddir].next);
+		if (!expire_set ||
+		    time_before((unsigned long)rq->fifo_time, expire))
+			expire = rq->fifo_time;
+		expire_set = true;
+	}
+
+	if (ds->expire != expire)
+		WRITE_ONCE(ds->expire, expire);
+	if (ds->expire_set != expire_set)
+		WRITE_ONCE(ds->expire_set, expire_set);
+}
+
+static bool dd_shard_has_work(struct dd_shard *ds)
+{
+	return !list_empty_careful(&ds->dispatch) ||
+		!list_empty_careful(&ds->fifo_list[0]) ||
+		!list_empty_careful(&ds->fifo_list[1]);
+}
+
+static bool dd_shard_expired(struct dd_shard *ds, unsigned long now)
+{
+	return READ_ONCE(ds->expire_set) &&
+		!time_before(now, READ_ONCE(ds->expire));
+}
+
+/*
+ * Whether a shard other than the one of @hctx has an expired request.
+ * dd_has_work() reports those too, so that a hardware queue without work
+ * of its own still ages them out.
+ */
+static bool dd_other_shard_expired(struct blk_mq_hw_ctx *hctx,
+				   unsigned long now)
+{
+	struct blk_mq_hw_ctx *other;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(hctx->queue, other, i) {
+		if (other != hctx && dd_shard_expired(other->sched_data, now))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * A shard is normally only dispatched from its own hardware queue.  To
+ * keep the deadline guarantee when that hardware queue falls behind, at
+ * most once a jiffy look for another shard with an expired request and
+ * dispatch the oldest one from here.  A hardware queue with no work of
+ * its own (@idle) scans every time.  A shard that is locked is being
+ * worked on by its owner and is skipped.
+ */
+static struct request *dd_dispatch_expired(struct deadline_data *dd,
+					   struct blk_mq_hw_ctx *hctx,
+					   bool idle)
+{
+	unsigned long now = jiffies;
+	struct blk_mq_hw_ctx *other;
+	struct request *rq = NULL;
+	unsigned int i;
+
+	if (!idle) {
+		if (time_before(now, READ_ONCE(dd->next_expire_scan)))
+			return NULL;
+		WRITE_ONCE(dd->next_expire_scan, now + 1);
+	}
+
+	queue_for_each_hw_ctx(hctx->queue, other, i) {
+		struct dd_shard *ds = other->sched_data;
+		int ddir;
+
+		if (other == hctx || !dd_shard_expired(ds, now))
+			continue;
+		if (!spin_trylock(&ds->lock))
+			continue;
+
+		for (ddir = READ; ddir <= WRITE; ddir++) {
+			if (list_empty(&ds->fifo_list[ddir]) ||
+			    !deadline_check_fifo(ds, ddir))
+				continue;
+			rq = rq_entry_fifo(ds->fifo_list[ddir].next);
+			ds->batching = 0;
+			deadline_move_request(ds, rq);
+			rq->rq_flags |= RQF_STARTED;
+			break;
+		}
+		dd_update_expire(ds);
+		spin_unlock(&ds->lock);
+
+		if (rq)
+			break;
+	}
+
+	return rq;
+}
+
 /*
  * One confusing aspect here is that we get called for a specific
  * hardware queue, but we may return a request that is for a
  * different hardware queue. This is because mq-deadline has shared
- * state for all hardware queues, in terms of sorting, FIFOs, etc.
+ * state for all hardware queues, in terms of sorting, FIFOs, etc, unless
+ * the queue is sharded.  Sharded queues still do so for expired requests
+ * of other shards, see dd_dispatch_expired().
  *
  * For a zoned block device, __dd_dispatch_request() may return NULL
  * if all the queued write requests are directed at zones that are already
@@ -387,24 +530,43 @@ static struct request *__dd_dispatch_request(struct deadline_data *dd)
 static struct request *dd_dispatch_request(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds = hctx->sched_data;
 	struct request *rq;
 
-	spin_lock(&dd->lock);
-	rq = __dd_dispatch_request(dd);
+	if (dd->sharded) {
+		rq = dd_dispatch_expired(dd, hctx, !dd_shard_has_work(ds));
+		if (rq)
+			return rq;
+	}
+
+	spin_lock(&ds->lock);
+	rq = __dd_dispatch_request(dd, ds);
 	if (!rq && blk_queue_is_zoned(hctx->queue) &&
-	    !list_empty(&dd->fifo_list[WRITE]))
+	    !list_empty(&ds->fifo_list[WRITE]))
 		blk_mq_sched_mark_restart_hctx(hctx);
-	spin_unlock(&dd->lock);
+	if (dd->sharded)
+		dd_update_expire(ds);
+	spin_unlock(&ds->lock);
 
 	return rq;
 }
 
+static void dd_init_shard(struct dd_shard *ds)
+{
+	spin_lock_init(&ds->lock);
+	INIT_LIST_HEAD(&ds->fifo_list[READ]);
+	INIT_LIST_HEAD(&ds->fifo_list[WRITE]);
+	ds->sort_list[READ] = RB_ROOT;
+	ds->sort_list[WRITE] = RB_ROOT;
+	INIT_LIST_HEAD(&ds->dispatch);
+}
+
 static void dd_exit_queue(struct elevator_queue *e)
 {
 	struct deadline_data *dd = e->elevator_data;
 
-	BUG_ON(!list_empty(&dd->fifo_list[READ]));
-	BUG_ON(!list_empty(&dd->fifo_list[WRITE]));
+	BUG_ON(!list_empty(&dd->shard.fifo_list[READ]));
+	BUG_ON(!list_empty(&dd->shard.fifo_list[WRITE]));
 
 	kfree(dd);
 }
@@ -428,23 +590,58 @@ static int dd_init_queue(struct request_queue *q, struct elevator_type *e)
 	}
 	eq->elevator_data = dd;
 
-	INIT_LIST_HEAD(&dd->fifo_list[READ]);
-	INIT_LIST_HEAD(&dd->fifo_list[WRITE]);
-	dd->sort_list[READ] = RB_ROOT;
-	dd->sort_list[WRITE] = RB_ROOT;
 	dd->fifo_expire[READ] = read_expire;
 	dd->fifo_expire[WRITE] = write_expire;
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
-	spin_lock_init(&dd->lock);
 	spin_lock_init(&dd->zone_lock);
-	INIT_LIST_HEAD(&dd->dispatch);
+	dd_init_shard(&dd->shard);
+
+	/*
+	 * Zoned devices need a single view of all writes to a zone, so
+	 * they always keep one shard.
+	 */
+	dd->sharded = q->nr_hw_queues > 1 && !blk_queue_is_zoned(q);
+	dd->next_expire_scan = jiffies;
 
 	q->elevator = eq;
 	return 0;
 }
 
+static int dd_init_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds;
+
+	if (!dd->sharded) {
+		hctx->sched_data = &dd->shard;
+		return 0;
+	}
+
+	ds = kzalloc_node(sizeof(*ds), GFP_KERNEL, hctx->numa_node);
+	if (!ds)
+		return -ENOMEM;
+
+	dd_init_shard(ds);
+	hctx->sched_data = ds;
+	return 0;
+}
+
+static void dd_exit_hctx(struct blk_mq_hw_ctx *hctx, unsigned int hctx_idx)
+{
+	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
+	struct dd_shard *ds = hctx->sched_data;
+
+	if (!dd->sharded)
+		return;
+
+	BUG_ON(!list_empty(&ds->fifo_list[READ]));
+	BUG_ON(!list_empty(&ds->fifo_list[WRITE]));
+
+	kfree(ds);
+}
+
 static int dd_request_merge(struct request_queue *q, struct request **rq,
 			    struct bio *bio)
 {
@@ -455,7 +652,7 @@ static int dd_request_merge(struct request_queue *q, struct request **rq,
 	if (!dd->front_merges)
 		return ELEVATOR_NO_MERGE;
 
-	__rq = elv_rb_find(&dd->sort_list[bio_data_dir(bio)], sector);
+	__rq = elv_rb_find(&dd->shard.sort_list[bio_data_dir(bio)], sector);
 	if (__rq) {
 		BUG_ON(sector != blk_rq_pos(__rq));
 
@@ -472,12 +669,23 @@ static bool dd_bio_merge(struct blk_mq_hw_ctx *hctx, struct bio *bio)
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = hctx->sched_data;
 	struct request *free = NULL;
 	bool ret;
 
-	spin_lock(&dd->lock);
-	ret = blk_mq_sched_try_merge(q, bio, &free);
-	spin_unlock(&dd->lock);
+	spin_lock(&ds->lock);
+	/*
+	 * The merge hash and last_merge hint belong to the whole queue and
+	 * can't be used under a shard lock.  Sharded queues instead look
+	 * for a merge among the most recently queued requests of the shard.
+	 */
+	if (dd->sharded)
+		ret = blk_mq_sched_try_list_merge(q,
+				&ds->fifo_list[bio_data_dir(bio)], bio,
+				dd->front_merges);
+	else
+		ret = blk_mq_sched_try_merge(q, bio, &free);
+	spin_unlock(&ds->lock);
 
 	if (free)
 		blk_mq_free_request(free);
@@ -493,6 +701,7 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = hctx->sched_data;
 	const int data_dir = rq_data_dir(rq);
 
 	/*
@@ -501,20 +710,20 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 	 */
 	blk_req_zone_write_unlock(rq);
 
-	if (blk_mq_sched_try_insert_merge(q, rq))
+	if (!dd->sharded && blk_mq_sched_try_insert_merge(q, rq))
 		return;
 
 	blk_mq_sched_request_inserted(rq);
 
 	if (at_head || blk_rq_is_passthrough(rq)) {
 		if (at_head)
-			list_add(&rq->queuelist, &dd->dispatch);
+			list_add(&rq->queuelist, &ds->dispatch);
 		else
-			list_add_tail(&rq->queuelist, &dd->dispatch);
+			list_add_tail(&rq->queuelist, &ds->dispatch);
 	} else {
-		deadline_add_rq_rb(dd, rq);
+		deadline_add_rq_rb(ds, rq);
 
-		if (rq_mergeable(rq)) {
+		if (!dd->sharded && rq_mergeable(rq)) {
 			elv_rqhash_add(q, rq);
 			if (!q->last_merge)
 				q->last_merge = rq;
@@ -524,7 +733,7 @@ static void dd_insert_request(struct blk_mq_hw_ctx *hctx, struct request *rq,
 		 * set expire time and add to fifo list
 		 */
 		rq->fifo_time = jiffies + dd->fifo_expire[data_dir];
-		list_add_tail(&rq->queuelist, &dd->fifo_list[data_dir]);
+		list_add_tail(&rq->queuelist, &ds->fifo_list[data_dir]);
 	}
 }
 
@@ -533,8 +742,9 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 {
 	struct request_queue *q = hctx->queue;
 	struct deadline_data *dd = q->elevator->elevator_data;
+	struct dd_shard *ds = hctx->sched_data;
 
-	spin_lock(&dd->lock);
+	spin_lock(&ds->lock);
 	while (!list_empty(list)) {
 		struct request *rq;
 
@@ -542,7 +752,9 @@ static void dd_insert_requests(struct blk_mq_hw_ctx *hctx,
 		list_del_init(&rq->queuelist);
 		dd_insert_request(hctx, rq, at_head);
 	}
-	spin_unlock(&dd->lock);
+	if (dd->sharded)
+		dd_update_expire(ds);
+	spin_unlock(&ds->lock);
 }
 
 /*
@@ -578,9 +790,10 @@ static bool dd_has_work(struct blk_mq_hw_ctx *hctx)
 {
 	struct deadline_data *dd = hctx->queue->elevator->elevator_data;
 
-	return !list_empty_careful(&dd->dispatch) ||
-		!list_empty_careful(&dd->fifo_list[0]) ||
-		!list_empty_careful(&dd->fifo_list[1]);
+	if (dd_shard_has_work(hctx->sched_data))
+		return true;
+
+	return dd->sharded && dd_other_shard_expired(hctx, jiffies);
 }
 
 /*
@@ -655,31 +868,31 @@ static struct elv_fs_entry deadline_attrs[] = {
 #define DEADLINE_DEBUGFS_DDIR_ATTRS(ddir, name)				\
 static void *deadline_##name##_fifo_start(struct seq_file *m,		\
 					  loff_t *pos)			\
-	__acquires(&dd->lock)						\
+	__acquires(&ds->lock)						\
 {									\
-	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *ds = hctx->sched_data;				\
 									\
-	spin_lock(&dd->lock);						\
-	return seq_list_start(&dd->fifo_list[ddir], *pos);		\
+	spin_lock(&ds->lock);						\
+	return seq_list_start(&ds->fifo_list[ddir], *pos);		\
 }									\
 									\
 static void *deadline_##name##_fifo_next(struct seq_file *m, void *v,	\
 					 loff_t *pos)			\
 {									\
-	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *ds = hctx->sched_data;				\
 									\
-	return seq_list_next(v, &dd->fifo_list[ddir], pos);		\
+	return seq_list_next(v, &ds->fifo_list[ddir], pos);		\
 }									\
 									\
 static void deadline_##name##_fifo_stop(struct seq_file *m, void *v)	\
-	__releases(&dd->lock)						\
+	__releases(&ds->lock)						\
 {									\
-	struct request_queue *q = m->private;				\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
+	struct blk_mq_hw_ctx *hctx = m->private;			\
+	struct dd_shard *ds = hctx->sched_data;				\
 									\
-	spin_unlock(&dd->lock);						\
+	spin_unlock(&ds->lock);						\
 }									\
 									\
 static const struct seq_operations deadline_##name##_fifo_seq_ops = {	\
@@ -692,9 +905,9 @@ static const struct seq_operations deadline_##name##_fifo_seq_ops = {	\
 static int deadline_##name##_next_rq_show(void *data,			\
 					  struct seq_file *m)		\
 {									\
-	struct request_queue *q = data;					\
-	struct deadline_data *dd = q->elevator->elevator_data;		\
-	struct request *rq = dd->next_rq[ddir];				\
+	struct blk_mq_hw_ctx *hctx = data;				\
+	struct dd_shard *ds = hctx->sched_data;				\
+	struct request *rq = ds->next_rq[ddir];				\
 									\
 	if (rq)								\
 		__blk_mq_debugfs_rq_show(m, rq);			\
@@ -706,47 +919,47 @@ DEADLINE_DEBUGFS_DDIR_ATTRS(WRITE, write)
 
 static int deadline_batching_show(void *data, struct seq_file *m)
 {
-	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *ds = hctx->sched_data;
 
-	seq_printf(m, "%u\n", dd->batching);
+	seq_printf(m, "%u\n", ds->batching);
 	return 0;
 }
 
 static int deadline_starved_show(void *data, struct seq_file *m)
 {
-	struct request_queue *q = data;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = data;
+	struct dd_shard *ds = hctx->sched_data;
 
-	seq_printf(m, "%u\n", dd->starved);
+	seq_printf(m, "%u\n", ds->starved);
 	return 0;
 }
 
 static void *deadline_dispatch_start(struct seq_file *m, loff_t *pos)
-	__acquires(&dd->lock)
+	__acquires(&ds->lock)
 {
-	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = m->private;
+	struct dd_shard *ds = hctx->sched_data;
 
-	spin_lock(&dd->lock);
-	return seq_list_start(&dd->dispatch, *pos);
+	spin_lock(&ds->lock);
+	return seq_list_start(&ds->dispatch, *pos);
 }
 
 static void *deadline_dispatch_next(struct seq_file *m, void *v, loff_t *pos)
 {
-	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = m->private;
+	struct dd_shard *ds = hctx->sched_data;
 
-	return seq_list_next(v, &dd->dispatch, pos);
+	return seq_list_next(v, &ds->dispatch, pos);
 }
 
 static void deadline_dispatch_stop(struct seq_file *m, void *v)
-	__releases(&dd->lock)
+	__releases(&ds->lock)
 {
-	struct request_queue *q = m->private;
-	struct deadline_data *dd = q->elevator->elevator_data;
+	struct blk_mq_hw_ctx *hctx = m->private;
+	struct dd_shard *ds = hctx->sched_data;
 
-	spin_unlock(&dd->lock);
+	spin_unlock(&ds->lock);
 }
 
 static const struct seq_operations deadline_dispatch_seq_ops = {
@@ -756,18 +969,32 @@ static const struct seq_operations deadline_dispatch_seq_ops = {
 	.show	= blk_mq_debugfs_rq_show,
 };
 
-#define DEADLINE_QUEUE_DDIR_ATTRS(name)						\
+static int deadline_sharded_show(void *data, struct seq_file *m)
+{
+	struct request_queue *q = data;
+	struct deadline_data *dd = q->elevator->elevator_data;
+
+	seq_printf(m, "%d\n", dd->sharded);
+	return 0;
+}
+
+static const struct blk_mq_debugfs_attr deadline_queue_debugfs_attrs[] = {
+	{"sharded", 0400, deadline_sharded_show},
+	{},
+};
+
+#define DEADLINE_HCTX_DDIR_ATTRS(name)						\
 	{#name "_fifo_list", 0400, .seq_ops = &deadline_##name##_fifo_seq_ops},	\
 	{#name "_next_rq", 0400, deadline_##name##_next_rq_show}
-static const struct blk_mq_debugfs_attr deadline_queue_debugfs_attrs[] = {
-	DEADLINE_QUEUE_DDIR_ATTRS(read),
-	DEADLINE_QUEUE_DDIR_ATTRS(write),
+static const struct blk_mq_debugfs_attr deadline_hctx_debugfs_attrs[] = {
+	DEADLINE_HCTX_DDIR_ATTRS(read),
+	DEADLINE_HCTX_DDIR_ATTRS(write),
 	{"batching", 0400, deadline_batching_show},
 	{"starved", 0400, deadline_starved_show},
 	{"dispatch", 0400, .seq_ops = &deadline_dispatch_seq_ops},
 	{},
 };
-#undef DEADLINE_QUEUE_DDIR_ATTRS
+#undef DEADLINE_HCTX_DDIR_ATTRS
 #endif
 
 static struct elevator_type mq_deadline = {
@@ -785,11 +1012,14 @@ static struct elevator_type mq_deadline = {
 		.has_work		= dd_has_work,
 		.init_sched		= dd_init_queue,
 		.exit_sched		= dd_exit_queue,
+		.init_hctx		= dd_init_hctx,
+		.exit_hctx		= dd_exit_hctx,
 	},
 
 	.uses_mq	= true,
 #ifdef CONFIG_BLK_DEBUG_FS
 	.queue_debugfs_attrs = deadline_queue_debugfs_attrs,
+	.hctx_debugfs_attrs = deadline_hctx_debugfs_attrs,
 #endif
 	.elevator_attrs = deadline_attrs,
 	.elevator_name = "mq-deadline",
@@ -52,6 +52,8 @@ static unsigned int num_devices = 1;
 static size_t huge_class_size;
 
 static void zram_free_page(struct zram *zram, size_t index);
+static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
+				u32 index, int offset, struct bio *bio);
 
 static int zram_slot_trylock(struct zram *zram, u32 index)
 {
@@ -75,9 +77,9 @@ static inline bool init_done(struct zram *zram)
 
 static inline bool zram_allocated(struct zram *zram, u32 index)
 {
-
-	return (zram->table[index].value >> (ZRAM_FLAG_SHIFT + 1)) ||
-					zram->table[index].handle;
+	return zram_get_obj_size(zram, index) ||
+			zram_test_flag(zram, index, ZRAM_SAME) ||
+			zram_test_flag(zram, index, ZRAM_WB);
 }
 
 static inline struct zram *dev_to_zram(struct device *dev)
@@ -447,18 +449,34 @@ static ssize_t backing_dev_store(struct device *dev,
 	return err;
 }
 
-static unsigned long get_entry_bdev(struct zram *zram)
+/*
+ * Reserve up to *nr contiguous blocks of the backing device, trimming *nr
+ * to the longest free range found, and return the first one. Returns 0 if
+ * the device is full. Allocators serialize on bitmap_lock, while blocks
+ * are still set and cleared atomically so put_entry_bdev() need not lock.
+ */
+static unsigned long get_entry_range_bdev(struct zram *zram, unsigned int *nr)
 {
-	unsigned long blk_idx = 1;
-retry:
-	/* skip 0 bit to confuse zram.handle = 0 */
-	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
-	if (blk_idx == zram->nr_pages)
-		return 0;
+	unsigned long blk_idx = 0, i;
+	unsigned int want;
 
-	if (test_and_set_bit(blk_idx, zram->bitmap))
-		goto retry;
+	spin_lock(&zram->bitmap_lock);
+	for (want = *nr; want; want /= 2) {
+		/* skip 0 bit to confuse zram.handle = 0 */
+		blk_idx = bitmap_find_next_zero_area(zram->bitmap,
+						     zram->nr_pages, 1, want, 0);
+		if (blk_idx + want <= zram->nr_pages)
+			break;
+	}
+	if (want) {
+		for (i = blk_idx; i < blk_idx + want; i++)
+			set_bit(i, zram->bitmap);
+	} else {
+		blk_idx = 0;
+	}
+	spin_unlock(&zram->bitmap_lock);
 
+	*nr = want;
 	return blk_idx;
 }
 
@@ -563,24 +581,31 @@ static int read_from_bdev_sync(struct zram *zram, struct bio_vec *bvec,
 static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
 			unsigned long entry, struct bio *parent, bool sync)
 {
+	atomic64_inc(&zram->stats.bd_reads);
 	if (sync)
 		return read_from_bdev_sync(zram, bvec, entry, parent);
 	else
 		return read_from_bdev_async(zram, bvec, entry, parent);
 }
 
+/*
+ * Write an incompressible page straight to the backing device from the
+ * write path. Pages that don't make it stay in memory as ZRAM_HUGE, for
+ * writeback_store() to pick up later.
+ */
 static int write_to_bdev(struct zram *zram, struct bio_vec *bvec,
 					u32 index, struct bio *parent,
 					unsigned long *pentry)
 {
 	struct bio *bio;
 	unsigned long entry;
+	unsigned int nr = 1;
 
 	bio = bio_alloc(GFP_ATOMIC, 1);
 	if (!bio)
 		return -ENOMEM;
 
-	entry = get_entry_bdev(zram);
+	entry = get_entry_range_bdev(zram, &nr);
 	if (!entry) {
 		bio_put(bio);
 		return -ENOSPC;
@@ -605,6 +630,8 @@ static int write_to_bdev(struct zram *zram, struct bio_vec *bvec,
 
 	submit_bio(bio);
 	*pentry = entry;
+	atomic64_inc(&zram->stats.bd_count);
+	atomic64_inc(&zram->stats.bd_writes);
 
 	return 0;
 }
@@ -617,21 +644,404 @@ static void zram_wb_clear(struct zram *zram, u32 index)
 	entry = zram_get_element(zram, index);
 	zram_set_element(zram, index, 0);
 	put_entry_bdev(zram, entry);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+/*
+ * idle_store() marks slots ZRAM_IDLE and any access clears the flag again,
+ * so the slots still idle at writeback time have not been touched since.
+ * With CONFIG_ZRAM_MEMORY_TRACKING a number of seconds can be written
+ * instead of "all", to only mark slots not accessed for that long.
+ */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages, index;
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	ktime_t cutoff = 0;
+#endif
+
+	if (!sysfs_streq(buf, "all")) {
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+		u64 age_sec;
+
+		if (kstrtoull(buf, 10, &age_sec))
+			return -EINVAL;
+		cutoff = ktime_sub(ktime_get_boottime(),
+				   ns_to_ktime(age_sec * NSEC_PER_SEC));
+#else
+		return -EINVAL;
+#endif
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		zram_slot_lock(zram, index);
+		/*
+		 * A slot under writeback must not become idle again after
+		 * being freed and rewritten, see zram_wb_batch_finish().
+		 */
+		if (!zram_allocated(zram, index) ||
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+			goto next;
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+		if (cutoff && ktime_after(zram->table[index].ac_time, cutoff))
+			goto next;
+#endif
+		zram_set_flag(zram, index, ZRAM_IDLE);
+next:
+		zram_slot_unlock(zram, index);
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+/*
+ * Writeback collects candidate slots into batches of ZRAM_WB_BATCH_PAGES
+ * and writes each batch to contiguous ranges of the backing device with
+ * as few bios as the free space allows. Up to ZRAM_WB_MAX_INFLIGHT
+ * batches are in flight while the next one is being collected. Finished
+ * batches are handed back to the writer, as the slot lock cannot be taken
+ * from bio completion.
+ */
+#define ZRAM_WB_BATCH_PAGES	64
+#define ZRAM_WB_MAX_INFLIGHT	4
+
+#define IDLE_WRITEBACK		1
+#define HUGE_WRITEBACK		2
+
+struct zram_wb_ctl {
+	struct zram *zram;
+	spinlock_t done_lock;
+	struct list_head done;		/* batches whose IO has completed */
+	wait_queue_head_t wait;
+	unsigned int nr_inflight;	/* only touched by the writer */
+};
+
+struct zram_wb_batch {
+	struct zram_wb_ctl *ctl;
+	struct list_head list;
+	atomic_t pending;		/* bios in flight, +1 for the writer */
+	blk_status_t status;
+	unsigned int nr_pages;
+	u32 index[ZRAM_WB_BATCH_PAGES];
+	unsigned long blk_idx[ZRAM_WB_BATCH_PAGES];
+	struct page *pages[ZRAM_WB_BATCH_PAGES];
+};
+
+static void zram_wb_batch_free(struct zram_wb_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < ZRAM_WB_BATCH_PAGES; i++)
+		if (batch->pages[i])
+			__free_page(batch->pages[i]);
+	kfree(batch);
+}
+
+static struct zram_wb_batch *zram_wb_batch_alloc(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_batch *batch;
+	int i;
+
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return NULL;
+
+	for (i = 0; i < ZRAM_WB_BATCH_PAGES; i++) {
+		batch->pages[i] = alloc_page(GFP_KERNEL | __GFP_NOWARN);
+		if (!batch->pages[i]) {
+			zram_wb_batch_free(batch);
+			return NULL;
+		}
+	}
+	batch->ctl = ctl;
+	atomic_set(&batch->pending, 1);
+
+	return batch;
+}
+
+static void zram_wb_batch_put(struct zram_wb_batch *batch)
+{
+	struct zram_wb_ctl *ctl = batch->ctl;
+	unsigned long flags;
+
+	if (!atomic_dec_and_test(&batch->pending))
+		return;
+
+	spin_lock_irqsave(&ctl->done_lock, flags);
+	list_add_tail(&batch->list, &ctl->done);
+	wake_up(&ctl->wait);
+	spin_unlock_irqrestore(&ctl->done_lock, flags);
+}
+
+static void zram_wb_end_io(struct bio *bio)
+{
+	struct zram_wb_batch *batch = bio->bi_private;
+
+	if (bio->bi_status)
+		batch->status = bio->bi_status;
+	bio_put(bio);
+	zram_wb_batch_put(batch);
+}
+
+/*
+ * Move the written slots of a batch to the backing device, and give the
+ * blocks of the others back.
+ */
+static void zram_wb_batch_finish(struct zram *zram,
+				 struct zram_wb_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->nr_pages; i++) {
+		u32 index = batch->index[i];
+		unsigned long blk_idx = batch->blk_idx[i];
+
+		zram_slot_lock(zram, index);
+		/*
+		 * The slot may have been freed, rewritten or read while it
+		 * was being written. All of these clear ZRAM_IDLE, and
+		 * idle_store() leaves ZRAM_UNDER_WB slots alone, so a slot
+		 * that is still idle holds the data that was written.
+		 */
+		if (batch->status || !blk_idx ||
+		    !zram_allocated(zram, index) ||
+		    !zram_test_flag(zram, index, ZRAM_IDLE)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+			if (blk_idx)
+				put_entry_bdev(zram, blk_idx);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_set_element(zram, index, blk_idx);
+		atomic64_inc(&zram->stats.pages_stored);
+		atomic64_inc(&zram->stats.bd_count);
+		atomic64_inc(&zram->stats.bd_writes);
+		zram_slot_unlock(zram, index);
+	}
+
+	zram_wb_batch_free(batch);
+}
+
+/* Finish completed batches until no more than @max are in flight */
+static void zram_wb_reap(struct zram_wb_ctl *ctl, unsigned int max)
+{
+	struct zram_wb_batch *batch;
+
+	while (ctl->nr_inflight > max) {
+		spin_lock_irq(&ctl->done_lock);
+		wait_event_lock_irq(ctl->wait, !list_empty(&ctl->done),
+				    ctl->done_lock);
+		batch = list_first_entry(&ctl->done, struct zram_wb_batch,
+					 list);
+		list_del(&batch->list);
+		spin_unlock_irq(&ctl->done_lock);
+
+		zram_wb_batch_finish(ctl->zram, batch);
+		ctl->nr_inflight--;
+	}
+}
+
+/*
+ * Reserve backing blocks for a full or final batch and write it out.
+ * Returns -ENOSPC if the backing device filled up, in which case the
+ * pages left without a block are dropped when the batch finishes.
+ */
+static int zram_wb_batch_submit(struct zram_wb_ctl *ctl,
+				struct zram_wb_batch *batch)
+{
+	struct zram *zram = ctl->zram;
+	unsigned int i = 0, nr;
+	unsigned long blk_idx;
+	struct bio *bio;
+	int ret = 0;
+
+	zram_wb_reap(ctl, ZRAM_WB_MAX_INFLIGHT - 1);
+	ctl->nr_inflight++;
+
+	while (i < batch->nr_pages) {
+		nr = batch->nr_pages - i;
+		blk_idx = get_entry_range_bdev(zram, &nr);
+		if (!blk_idx) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		bio = bio_alloc(GFP_NOIO, nr);
+		bio_set_dev(bio, zram->bdev);
+		bio->bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
+		bio->bi_opf = REQ_OP_WRITE;
+		bio->bi_end_io = zram_wb_end_io;
+		bio->bi_private = batch;
+		for (; nr; nr--, i++, blk_idx++) {
+			batch->blk_idx[i] = blk_idx;
+			bio_add_page(bio, batch->pages[i], PAGE_SIZE, 0);
+		}
+
+		atomic_inc(&batch->pending);
+		submit_bio(bio);
+	}
+
+	zram_wb_batch_put(batch);
+	return ret;
+}
+
+static bool zram_wb_candidate(struct zram *zram, u32 index, int mode)
+{
+	if (!zram_allocated(zram, index) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return false;
+
+	if (mode == IDLE_WRITEBACK)
+		return zram_test_flag(zram, index, ZRAM_IDLE);
+	return zram_test_flag(zram, index, ZRAM_HUGE);
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_wb_batch *batch = NULL;
+	struct zram_wb_ctl ctl;
+	unsigned long nr_pages, index;
+	ssize_t ret = len;
+	int mode, err;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = IDLE_WRITEBACK;
+	else if (sysfs_streq(buf, "huge"))
+		mode = HUGE_WRITEBACK;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto release_init_lock;
+	}
+
+	if (!zram_wb_enabled(zram)) {
+		ret = -ENODEV;
+		goto release_init_lock;
+	}
+
+	ctl.zram = zram;
+	spin_lock_init(&ctl.done_lock);
+	INIT_LIST_HEAD(&ctl.done);
+	init_waitqueue_head(&ctl.wait);
+	ctl.nr_inflight = 0;
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		struct bio_vec bvec;
+
+		if (!batch) {
+			batch = zram_wb_batch_alloc(&ctl);
+			if (!batch) {
+				ret = -ENOMEM;
+				break;
+			}
+		}
+
+		zram_slot_lock(zram, index);
+		if (!zram_wb_candidate(zram, index, mode)) {
+			zram_slot_unlock(zram, index);
+			continue;
+		}
+		/*
+		 * Clearing ZRAM_UNDER_WB is the duty of the writeback code,
+		 * zram_free_page() never clears it. Huge pages are marked
+		 * idle too, to catch them being freed or rewritten.
+		 */
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+
+		bvec.bv_page = batch->pages[batch->nr_pages];
+		bvec.bv_len = PAGE_SIZE;
+		bvec.bv_offset = 0;
+		if (zram_bvec_read(zram, &bvec, index, 0, NULL)) {
+			zram_slot_lock(zram, index);
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+			continue;
+		}
+
+		batch->index[batch->nr_pages++] = index;
+		if (batch->nr_pages < ZRAM_WB_BATCH_PAGES)
+			continue;
+
+		err = zram_wb_batch_submit(&ctl, batch);
+		batch = NULL;
+		if (err) {
+			ret = err;
+			break;
+		}
+	}
+
+	if (batch && batch->nr_pages) {
+		err = zram_wb_batch_submit(&ctl, batch);
+		if (err)
+			ret = err;
+	} else if (batch) {
+		zram_wb_batch_free(batch);
+	}
+
+	zram_wb_reap(&ctl, 0);
+release_init_lock:
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.bd_count),
+			(u64)atomic64_read(&zram->stats.bd_reads),
+			(u64)atomic64_read(&zram->stats.bd_writes));
+	up_read(&zram->init_lock);
+
+	return ret;
 }
 
 #else
 static bool zram_wb_enabled(struct zram *zram) { return false; }
 static inline void reset_bdev(struct zram *zram) {};
-static int write_to_bdev(struct zram *zram, struct bio_vec *bvec,
-					u32 index, struct bio *parent,
-					unsigned long *pentry)
 
+static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
+			unsigned long entry, struct bio *parent, bool sync)
 {
 	return -EIO;
 }
 
-static int read_from_bdev(struct zram *zram, struct bio_vec *bvec,
-			unsigned long entry, struct bio *parent, bool sync)
+static int write_to_bdev(struct zram *zram, struct bio_vec *bvec,
+					u32 index, struct bio *parent,
+					unsigned long *pentry)
+
 {
 	return -EIO;
 }
@@ -654,6 +1064,7 @@ static void zram_debugfs_destroy(void)
 
 static void zram_accessed(struct zram *zram, u32 index)
 {
+	zram_clear_flag(zram, index, ZRAM_IDLE);
 	zram->table[index].ac_time = ktime_get_boottime();
 }
 
@@ -691,12 +1102,13 @@ static ssize_t read_block_state(struct file *file, char __user *buf,
 
 		ts = ktime_to_timespec64(zram->table[index].ac_time);
 		copied = snprintf(kbuf + written, count,
-			"%12zd %12lld.%06lu %c%c%c\n",
+			"%12zd %12lld.%06lu %c%c%c%c\n",
 			index, (s64)ts.tv_sec,
 			ts.tv_nsec / NSEC_PER_USEC,
 			zram_test_flag(zram, index, ZRAM_SAME) ? 's' : '.',
 			zram_test_flag(zram, index, ZRAM_WB) ? 'w' : '.',
-			zram_test_flag(zram, index, ZRAM_HUGE) ? 'h' : '.');
+			zram_test_flag(zram, index, ZRAM_HUGE) ? 'h' : '.',
+			zram_test_flag(zram, index, ZRAM_IDLE) ? 'i' : '.');
 
 		if (count < copied) {
 			zram_slot_unlock(zram, index);
@@ -741,7 +1153,10 @@ static void zram_debugfs_unregister(struct zram *zram)
 #else
 static void zram_debugfs_create(void) {};
 static void zram_debugfs_destroy(void) {};
-static void zram_accessed(struct zram *zram, u32 index) {};
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+};
 static void zram_reset_access(struct zram *zram, u32 index) {};
 static void zram_debugfs_register(struct zram *zram) {};
 static void zram_debugfs_unregister(struct zram *zram) {};
@@ -944,6 +1359,7 @@ static void zram_free_page(struct zram *zram, size_t index)
 	unsigned long handle;
 
 	zram_reset_access(zram, index);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
 
 	if (zram_test_flag(zram, index, ZRAM_HUGE)) {
 		zram_clear_flag(zram, index, ZRAM_HUGE);
@@ -1619,6 +2035,9 @@ static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(idle);
+static DEVICE_ATTR_WO(writeback);
+static DEVICE_ATTR_RO(bd_stat);
 #endif
 
 static struct attribute *zram_disk_attrs[] = {
@@ -1632,6 +2051,9 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_comp_algorithm.attr,
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_stat.attr,
 #endif
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
@@ -1668,6 +2090,9 @@ static int zram_add(void)
 	device_id = ret;
 
 	init_rwsem(&zram->init_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+#endif
 
 	queue = blk_alloc_queue(GFP_KERNEL);
 	if (!queue) {
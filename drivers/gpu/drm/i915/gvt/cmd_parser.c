@@ -35,6 +35,7 @@
  */
 
 #include <linux/slab.h>
+#include <linux/jhash.h>
 #include "i915_drv.h"
 #include "gvt.h"
 #include "i915_pvinfo.h"
@@ -365,8 +366,6 @@ struct parser_exec_state;
 
 typedef int (*parser_cmd_handler)(struct parser_exec_state *s);
 
-#define GVT_CMD_HASH_BITS   7
-
 /* which DWords need address fix */
 #define ADDR_FIX_1(x1)			(1 << (x1))
 #define ADDR_FIX_2(x1, x2)		(ADDR_FIX_1(x1) | ADDR_FIX_1(x2))
@@ -423,9 +422,33 @@ struct cmd_info {
 	parser_cmd_handler handler;
 };
 
-struct cmd_entry {
+/*
+ * Only batch buffers up to GVT_BB_CACHE_MAX_SIZE bytes with at most
+ * GVT_BB_CACHE_MAX_PATCHES audit patches are cached, and at most
+ * GVT_BB_CACHE_MAX_ENTRIES of them per vGPU, so the memory kept around
+ * stays bounded.
+ */
+#define GVT_BB_CACHE_MAX_SIZE		SZ_64K
+#define GVT_BB_CACHE_MAX_PATCHES	32
+#define GVT_BB_CACHE_MAX_ENTRIES	32
+
+struct bb_cache_patch {
+	u32 offset;
+	u32 val;
+};
+
+struct bb_cache_entry {
 	struct hlist_node hlist;
-	struct cmd_info *info;
+	struct list_head lru;
+	u32 hash;
+	int ring_id;
+	bool ppgtt;
+	unsigned long size;
+	/* guest contents the audit was performed on */
+	void *data;
+	/* dwords the audit rewrote in the shadow, re-applied on a hit */
+	unsigned int nr_patches;
+	struct bb_cache_patch patches[GVT_BB_CACHE_MAX_PATCHES];
 };
 
 enum {
@@ -477,6 +500,10 @@ struct parser_exec_state {
 	struct cmd_info *info;
 
 	struct intel_vgpu_workload *workload;
+
+	/* first level batch buffer being recorded into the bb cache */
+	struct bb_cache_entry *bb_rec;
+	void *bb_rec_va;
 };
 
 #define gmadr_dw_number(s)	\
@@ -625,29 +652,21 @@ static inline u32 get_opcode(u32 cmd, int ring_id)
 	return cmd >> (32 - d_info->op_len);
 }
 
-static inline struct cmd_info *find_cmd_entry(struct intel_gvt *gvt,
-		unsigned int opcode, int ring_id)
-{
-	struct cmd_entry *e;
-
-	hash_for_each_possible(gvt->cmd_table, e, hlist, opcode) {
-		if ((opcode == e->info->opcode) &&
-				(e->info->rings & (1 << ring_id)))
-			return e->info;
-	}
-	return NULL;
-}
-
 static inline struct cmd_info *get_cmd_info(struct intel_gvt *gvt,
 		u32 cmd, int ring_id)
 {
-	u32 opcode;
+	struct intel_gvt_cmd_table *t;
 
-	opcode = get_opcode(cmd, ring_id);
-	if (opcode == INVALID_OP)
+	/*
+	 * No hashing or chain walk here: the command type selects a per-ring
+	 * table and the remaining opcode bits index it directly. A NULL slot
+	 * means the command is unknown on this ring.
+	 */
+	t = &gvt->cmd_table[ring_id][CMD_TYPE(cmd)];
+	if (unlikely(!t->entries))
 		return NULL;
 
-	return find_cmd_entry(gvt, opcode, ring_id);
+	return t->entries[(cmd >> t->shift) & t->mask];
 }
 
 static inline u32 sub_op_val(u32 cmd, u32 hi, u32 low)
@@ -790,8 +809,49 @@ static inline int cmd_length(struct parser_exec_state *s)
 	return get_cmd_length(s->info, cmd_val(s, 0));
 }
 
+static void bb_cache_free_entry(struct bb_cache_entry *e)
+{
+	kvfree(e->data);
+	kfree(e);
+}
+
+/*
+ * The batch buffer being recorded did something whose effect is not
+ * captured by its contents and patches alone, so it must be fully
+ * scanned every time.
+ */
+static void bb_cache_taint(struct parser_exec_state *s)
+{
+	if (!s->bb_rec)
+		return;
+
+	bb_cache_free_entry(s->bb_rec);
+	s->bb_rec = NULL;
+}
+
+static void bb_cache_record_patch(struct parser_exec_state *s,
+		u32 *addr, u32 val)
+{
+	struct bb_cache_entry *e = s->bb_rec;
+	unsigned long offset;
+
+	if (!e)
+		return;
+
+	offset = (void *)addr - s->bb_rec_va;
+	if (offset >= e->size || e->nr_patches == GVT_BB_CACHE_MAX_PATCHES) {
+		bb_cache_taint(s);
+		return;
+	}
+
+	e->patches[e->nr_patches].offset = offset;
+	e->patches[e->nr_patches].val = val;
+	e->nr_patches++;
+}
+
 /* do not remove this, some platform may need clflush here */
 #define patch_value(s, addr, val) do { \
+	bb_cache_record_patch(s, addr, val); \
 	*addr = val; \
 } while (0)
 
@@ -854,6 +914,8 @@ static int mocs_cmd_reg_handler(struct parser_exec_state *s,
 {
 	if (!is_mocs_mmio(offset))
 		return -EINVAL;
+	/* the vreg update is not replayed from the bb cache */
+	bb_cache_taint(s);
 	vgpu_vreg(s->vgpu, offset) = cmd_val(s, index + 1);
 	return 0;
 }
@@ -904,6 +966,7 @@ static int cmd_reg_handler(struct parser_exec_state *s,
 	if (IS_KABYLAKE(s->vgpu->gvt->dev_priv) &&
 			intel_gvt_mmio_is_in_ctx(gvt, offset) &&
 			!strncmp(cmd, "lri", 3)) {
+		bb_cache_taint(s);
 		intel_gvt_hypervisor_read_gpa(s->vgpu,
 			s->workload->ring_context_gpa + 12, &ctx_sr_ctl, 4);
 		/* check inhibit context */
@@ -927,6 +990,13 @@ static int cmd_reg_handler(struct parser_exec_state *s,
 			patch_value(s, cmd_ptr(s, index), VGT_SCRATCH_REG);
 	}
 
+	/*
+	 * A cached batch buffer is only replayed if every register it
+	 * touches was already marked as accessed when it was recorded.
+	 */
+	if (!(gvt->mmio.mmio_attribute[offset >> 2] & F_CMD_ACCESSED))
+		bb_cache_taint(s);
+
 	/* TODO: Update the global mask if this MMIO is a masked-MMIO */
 	intel_gvt_mmio_set_cmd_accessed(gvt, offset);
 	return 0;
@@ -967,6 +1037,13 @@ static int cmd_handler_lri(struct parser_exec_state *s)
 		if (ret)
 			break;
 
+		/*
+		 * Whether these writes are checked depends on vGPU state
+		 * that changes over time, so never replay them from cache.
+		 */
+		if (intel_gvt_mmio_is_non_context(gvt, cmd_reg(s, i)))
+			bb_cache_taint(s);
+
 		if (s->vgpu->entire_nonctxmmio_checked
 				&& intel_gvt_mmio_is_non_context(gvt,
 				cmd_reg(s, i))) {
@@ -1145,14 +1222,17 @@ static int cmd_handler_pipe_control(struct parser_exec_state *s)
 	if (ret)
 		return ret;
 
-	if (cmd_val(s, 1) & PIPE_CONTROL_NOTIFY)
+	if (cmd_val(s, 1) & PIPE_CONTROL_NOTIFY) {
+		bb_cache_taint(s);
 		set_bit(cmd_interrupt_events[s->ring_id].pipe_control_notify,
 				s->workload->pending_events);
+	}
 	return 0;
 }
 
 static int cmd_handler_mi_user_interrupt(struct parser_exec_state *s)
 {
+	bb_cache_taint(s);
 	set_bit(cmd_interrupt_events[s->ring_id].mi_user_interrupt,
 			s->workload->pending_events);
 	patch_value(s, cmd_ptr(s, 0), MI_NOOP);
@@ -1164,10 +1244,15 @@ static int cmd_advance_default(struct parser_exec_state *s)
 	return ip_gma_advance(s, cmd_length(s));
 }
 
+static void bb_cache_commit(struct parser_exec_state *s);
+
 static int cmd_handler_mi_batch_buffer_end(struct parser_exec_state *s)
 {
 	int ret;
 
+	if (s->bb_rec && s->buf_type == BATCH_BUFFER_INSTRUCTION)
+		bb_cache_commit(s);
+
 	if (s->buf_type == BATCH_BUFFER_2ND_LEVEL) {
 		s->buf_type = BATCH_BUFFER_INSTRUCTION;
 		ret = ip_gma_set(s, s->ret_ip_gma_bb);
@@ -1400,6 +1485,8 @@ static int cmd_handler_mi_display_flip(struct parser_exec_state *s)
 	int i;
 	int len = cmd_length(s);
 
+	bb_cache_taint(s);
+
 	ret = decode_mi_display_flip(s, &info);
 	if (ret) {
 		gvt_vgpu_err("fail to decode MI display flip command\n");
@@ -1619,9 +1706,11 @@ static int cmd_handler_mi_flush_dw(struct parser_exec_state *s)
 		ret = cmd_address_audit(s, gma, sizeof(u64), index_mode);
 	}
 	/* Check notify bit */
-	if ((cmd_val(s, 0) & (1 << 8)))
+	if ((cmd_val(s, 0) & (1 << 8))) {
+		bb_cache_taint(s);
 		set_bit(cmd_interrupt_events[s->ring_id].mi_flush_dw,
 				s->workload->pending_events);
+	}
 	return ret;
 }
 
@@ -1730,7 +1819,92 @@ static int find_bb_size(struct parser_exec_state *s, unsigned long *bb_size)
 	return 0;
 }
 
-static int perform_bb_shadow(struct parser_exec_state *s)
+static void bb_cache_evict(struct intel_vgpu_bb_cache *cache)
+{
+	struct bb_cache_entry *e;
+
+	e = list_last_entry(&cache->lru, struct bb_cache_entry, lru);
+	hash_del(&e->hlist);
+	list_del(&e->lru);
+	cache->nr_entries--;
+	bb_cache_free_entry(e);
+}
+
+/* the recorded batch buffer was scanned to its end without being tainted */
+static void bb_cache_commit(struct parser_exec_state *s)
+{
+	struct intel_vgpu_bb_cache *cache = &s->vgpu->submission.bb_cache;
+	struct bb_cache_entry *e = s->bb_rec;
+
+	s->bb_rec = NULL;
+
+	mutex_lock(&cache->lock);
+	if (cache->nr_entries == GVT_BB_CACHE_MAX_ENTRIES)
+		bb_cache_evict(cache);
+	hash_add(cache->table, &e->hlist, e->hash);
+	list_add(&e->lru, &cache->lru);
+	cache->nr_entries++;
+	mutex_unlock(&cache->lock);
+}
+
+/*
+ * Look up a freshly shadowed first level batch buffer in the vGPU's bb
+ * cache. The hash only selects candidates; a hit also requires the contents
+ * to be identical to those audited before, so a guest cannot slip an
+ * unaudited buffer through a hash collision.
+ *
+ * On a hit the recorded audit patches are applied to the shadow and a
+ * batch buffer end is emulated, skipping the scan. On a miss, recording
+ * starts so that the buffer can be cached once its scan completes.
+ */
+static int bb_cache_lookup(struct parser_exec_state *s, unsigned long size)
+{
+	struct intel_vgpu_bb_cache *cache = &s->vgpu->submission.bb_cache;
+	bool ppgtt = s->buf_addr_type == PPGTT_BUFFER;
+	struct bb_cache_entry *e;
+	u32 hash;
+	int i;
+
+	hash = jhash2(s->ip_va, size / sizeof(u32), s->ring_id);
+
+	mutex_lock(&cache->lock);
+	hash_for_each_possible(cache->table, e, hlist, hash) {
+		if (e->hash != hash || e->ring_id != s->ring_id ||
+		    e->ppgtt != ppgtt || e->size != size ||
+		    memcmp(e->data, s->ip_va, size))
+			continue;
+
+		for (i = 0; i < e->nr_patches; i++)
+			*(u32 *)(s->ip_va + e->patches[i].offset) =
+				e->patches[i].val;
+		list_move(&e->lru, &cache->lru);
+		mutex_unlock(&cache->lock);
+
+		return cmd_handler_mi_batch_buffer_end(s);
+	}
+	mutex_unlock(&cache->lock);
+
+	e = kzalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return 0;
+
+	e->data = kvmalloc(size, GFP_KERNEL);
+	if (!e->data) {
+		kfree(e);
+		return 0;
+	}
+	memcpy(e->data, s->ip_va, size);
+	e->hash = hash;
+	e->ring_id = s->ring_id;
+	e->ppgtt = ppgtt;
+	e->size = size;
+
+	s->bb_rec = e;
+	s->bb_rec_va = s->ip_va;
+	return 0;
+}
+
+static int perform_bb_shadow(struct parser_exec_state *s, bool from_ring)
 {
 	struct intel_vgpu *vgpu = s->vgpu;
 	struct intel_vgpu_shadow_bb *bb;
@@ -1822,6 +1996,9 @@ static int perform_bb_shadow(struct parser_exec_state *s)
 	 */
 	s->ip_va = bb->va + gma_start_offset;
 	s->ip_gma = gma;
+
+	if (from_ring && !s->is_ctx_wa && bb_size <= GVT_BB_CACHE_MAX_SIZE)
+		return bb_cache_lookup(s, bb_size);
 	return 0;
 err_unmap:
 	i915_gem_object_unpin_map(bb->obj);
@@ -1836,10 +2013,13 @@ static int perform_bb_shadow(struct parser_exec_state *s)
 
 static int cmd_handler_mi_batch_buffer_start(struct parser_exec_state *s)
 {
-	bool second_level;
+	bool second_level, from_ring;
 	int ret = 0;
 	struct intel_vgpu *vgpu = s->vgpu;
 
+	/* nested and chained batch buffers are not cached */
+	bb_cache_taint(s);
+
 	if (s->buf_type == BATCH_BUFFER_2ND_LEVEL) {
 		gvt_vgpu_err("Found MI_BATCH_BUFFER_START in 2nd level BB\n");
 		return -EFAULT;
@@ -1853,7 +2033,8 @@ static int cmd_handler_mi_batch_buffer_start(struct parser_exec_state *s)
 
 	s->saved_buf_addr_type = s->buf_addr_type;
 	addr_type_update_snb(s);
-	if (s->buf_type == RING_BUFFER_INSTRUCTION) {
+	from_ring = s->buf_type == RING_BUFFER_INSTRUCTION;
+	if (from_ring) {
 		s->ret_ip_gma_ring = s->ip_gma + cmd_length(s) * sizeof(u32);
 		s->buf_type = BATCH_BUFFER_INSTRUCTION;
 	} else if (second_level) {
@@ -1863,7 +2044,7 @@ static int cmd_handler_mi_batch_buffer_start(struct parser_exec_state *s)
 	}
 
 	if (batch_buffer_needs_scan(s)) {
-		ret = perform_bb_shadow(s);
+		ret = perform_bb_shadow(s, from_ring);
 		if (ret < 0)
 			gvt_vgpu_err("invalid shadow batch buffer\n");
 	} else {
@@ -2547,11 +2728,6 @@ static struct cmd_info cmd_info[] = {
 		0, 20, NULL},
 };
 
-static void add_cmd_entry(struct intel_gvt *gvt, struct cmd_entry *e)
-{
-	hash_add(gvt->cmd_table, &e->hlist, e->info->opcode);
-}
-
 /* call the cmd handler, and advance ip */
 static int cmd_parser_exec(struct parser_exec_state *s)
 {
@@ -2568,7 +2744,7 @@ static int cmd_parser_exec(struct parser_exec_state *s)
 	else
 		info = get_cmd_info(s->vgpu->gvt, cmd, s->ring_id);
 
-	if (info == NULL) {
+	if (unlikely(info == NULL)) {
 		gvt_vgpu_err("unknown cmd 0x%x, opcode=0x%x, addr_type=%s, ring %d, workload=%p\n",
 				cmd, get_opcode(cmd, s->ring_id),
 				(s->buf_addr_type == PPGTT_BUFFER) ?
@@ -2578,9 +2754,10 @@ static int cmd_parser_exec(struct parser_exec_state *s)
 
 	s->info = info;
 
-	trace_gvt_command(vgpu->id, s->ring_id, s->ip_gma, s->ip_va,
-			  cmd_length(s), s->buf_type, s->buf_addr_type,
-			  s->workload, info->name);
+	if (trace_gvt_command_enabled())
+		trace_gvt_command(vgpu->id, s->ring_id, s->ip_gma, s->ip_va,
+				  cmd_length(s), s->buf_type, s->buf_addr_type,
+				  s->workload, info->name);
 
 	if (info->handler) {
 		ret = info->handler(s);
@@ -2682,6 +2859,7 @@ static int scan_workload(struct intel_vgpu_workload *workload)
 	s.rb_va = workload->shadow_ring_buffer_va;
 	s.workload = workload;
 	s.is_ctx_wa = false;
+	s.bb_rec = NULL;
 
 	if ((bypass_scan_mask & (1 << workload->ring_id)) ||
 		gma_head == gma_tail)
@@ -2699,6 +2877,8 @@ static int scan_workload(struct intel_vgpu_workload *workload)
 	ret = command_scan(&s, workload->rb_head, workload->rb_tail,
 		workload->rb_start, _RING_CTL_BUF_SIZE(workload->rb_ctl));
 
+	/* scan stopped inside a batch buffer being recorded */
+	bb_cache_taint(&s);
 out:
 	return ret;
 }
@@ -2736,6 +2916,7 @@ static int scan_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 	s.rb_va = wa_ctx->indirect_ctx.shadow_va;
 	s.workload = workload;
 	s.is_ctx_wa = true;
+	s.bb_rec = NULL;
 
 	if (!intel_gvt_ggtt_validate_range(s.vgpu, s.ring_start, s.ring_size)) {
 		ret = -EINVAL;
@@ -2957,26 +3138,132 @@ int intel_gvt_scan_and_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 	return 0;
 }
 
-static struct cmd_info *find_cmd_entry_any_ring(struct intel_gvt *gvt,
-		unsigned int opcode, unsigned long rings)
+static void clean_cmd_table(struct intel_gvt *gvt)
 {
-	struct cmd_info *info = NULL;
+	struct intel_gvt_cmd_table *t;
+	int ring, type;
+
+	for (ring = 0; ring < I915_NUM_ENGINES; ring++) {
+		for (type = 0; type < GVT_CMD_TYPE_NUM; type++) {
+			t = &gvt->cmd_table[ring][type];
+			kvfree(t->entries);
+			memset(t, 0, sizeof(*t));
+		}
+	}
+}
+
+static int alloc_cmd_table(struct intel_gvt *gvt)
+{
+	struct intel_gvt_cmd_table *t;
+	struct decode_info *d_info;
+	int ring, type;
+
+	for (ring = 0; ring < I915_NUM_ENGINES; ring++) {
+		for (type = 0; type < GVT_CMD_TYPE_NUM; type++) {
+			d_info = ring_decode_info[ring][type];
+			if (!d_info)
+				continue;
+
+			t = &gvt->cmd_table[ring][type];
+			/* the top 3 opcode bits are the command type itself */
+			t->shift = 32 - d_info->op_len;
+			t->mask = (1U << (d_info->op_len - 3)) - 1;
+			t->entries = kvcalloc(t->mask + 1, sizeof(*t->entries),
+					      GFP_KERNEL);
+			if (!t->entries)
+				return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static struct intel_gvt_cmd_table *cmd_table_of(struct intel_gvt *gvt,
+		struct cmd_info *info, int ring_id)
+{
+	struct intel_gvt_cmd_table *t;
+	int type;
+
+	for (type = 0; type < GVT_CMD_TYPE_NUM; type++) {
+		t = &gvt->cmd_table[ring_id][type];
+		/* the type bits sit right above the table index */
+		if (t->entries && (info->opcode >> (29 - t->shift)) == type)
+			return t;
+	}
+	return NULL;
+}
+
+static int add_cmd_entry(struct intel_gvt *gvt, struct cmd_info *info)
+{
+	unsigned long rings = info->rings;
+	struct intel_gvt_cmd_table *t;
+	struct cmd_info **slot;
 	unsigned int ring;
 
 	for_each_set_bit(ring, &rings, I915_NUM_ENGINES) {
-		info = find_cmd_entry(gvt, opcode, ring);
-		if (info)
-			break;
+		t = cmd_table_of(gvt, info, ring);
+		if (!t)
+			continue;
+
+		slot = &t->entries[info->opcode & t->mask];
+		if (*slot) {
+			gvt_err("%s %s duplicated\n", info->name,
+					(*slot)->name);
+			return -EEXIST;
+		}
+		*slot = info;
 	}
-	return info;
+	return 0;
 }
 
-static int init_cmd_table(struct intel_gvt *gvt)
+#if IS_ENABLED(CONFIG_DRM_I915_DEBUG_GEM)
+/*
+ * Feed a synthetic header for every registered command through the same
+ * decode path used by the scanner and check that it resolves back to its
+ * own entry on every ring it is registered for.
+ */
+static int verify_cmd_table(struct intel_gvt *gvt)
 {
+	unsigned int gen_type = intel_gvt_get_device_type(gvt);
+	struct intel_gvt_cmd_table *t;
+	unsigned long rings;
+	unsigned int ring;
 	int i;
-	struct cmd_entry *e;
-	struct cmd_info	*info;
+
+	for (i = 0; i < ARRAY_SIZE(cmd_info); i++) {
+		if (!(cmd_info[i].devices & gen_type))
+			continue;
+
+		rings = cmd_info[i].rings;
+		for_each_set_bit(ring, &rings, I915_NUM_ENGINES) {
+			t = cmd_table_of(gvt, &cmd_info[i], ring);
+			if (!t)
+				continue;
+
+			if (get_cmd_info(gvt, cmd_info[i].opcode << t->shift,
+					 ring) != &cmd_info[i]) {
+				gvt_err("%s misdecoded on ring %d\n",
+						cmd_info[i].name, ring);
+				return -EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+#else
+static inline int verify_cmd_table(struct intel_gvt *gvt)
+{
+	return 0;
+}
+#endif
+
+static int init_cmd_table(struct intel_gvt *gvt)
+{
 	unsigned int gen_type;
+	int i, ret;
+
+	ret = alloc_cmd_table(gvt);
+	if (ret)
+		return ret;
 
 	gen_type = intel_gvt_get_device_type(gvt);
 
@@ -2984,41 +3271,48 @@ static int init_cmd_table(struct intel_gvt *gvt)
 		if (!(cmd_info[i].devices & gen_type))
 			continue;
 
-		e = kzalloc(sizeof(*e), GFP_KERNEL);
-		if (!e)
-			return -ENOMEM;
+		ret = add_cmd_entry(gvt, &cmd_info[i]);
+		if (ret)
+			return ret;
 
-		e->info = &cmd_info[i];
-		info = find_cmd_entry_any_ring(gvt,
-				e->info->opcode, e->info->rings);
-		if (info) {
-			gvt_err("%s %s duplicated\n", e->info->name,
-					info->name);
-			kfree(e);
-			return -EEXIST;
-		}
 		if (cmd_info[i].opcode == OP_MI_NOOP)
 			mi_noop_index = i;
 
-		INIT_HLIST_NODE(&e->hlist);
-		add_cmd_entry(gvt, e);
 		gvt_dbg_cmd("add %-30s op %04x flag %x devs %02x rings %02x\n",
-				e->info->name, e->info->opcode, e->info->flag,
-				e->info->devices, e->info->rings);
+				cmd_info[i].name, cmd_info[i].opcode,
+				cmd_info[i].flag, cmd_info[i].devices,
+				cmd_info[i].rings);
 	}
-	return 0;
+
+	return verify_cmd_table(gvt);
 }
 
-static void clean_cmd_table(struct intel_gvt *gvt)
+/**
+ * intel_vgpu_init_bb_cache - initialize the scanned batch buffer cache
+ * @vgpu: a vGPU
+ */
+void intel_vgpu_init_bb_cache(struct intel_vgpu *vgpu)
 {
-	struct hlist_node *tmp;
-	struct cmd_entry *e;
-	int i;
+	struct intel_vgpu_bb_cache *cache = &vgpu->submission.bb_cache;
 
-	hash_for_each_safe(gvt->cmd_table, i, tmp, e, hlist)
-		kfree(e);
+	mutex_init(&cache->lock);
+	hash_init(cache->table);
+	INIT_LIST_HEAD(&cache->lru);
+	cache->nr_entries = 0;
+}
+
+/**
+ * intel_vgpu_clean_bb_cache - drop all entries of the scanned bb cache
+ * @vgpu: a vGPU
+ */
+void intel_vgpu_clean_bb_cache(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_bb_cache *cache = &vgpu->submission.bb_cache;
 
-	hash_init(gvt->cmd_table);
+	mutex_lock(&cache->lock);
+	while (cache->nr_entries)
+		bb_cache_evict(cache);
+	mutex_unlock(&cache->lock);
 }
 
 void intel_gvt_clean_cmd_parser(struct intel_gvt *gvt)
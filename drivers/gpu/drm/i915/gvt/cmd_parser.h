@@ -36,7 +36,37 @@
 #ifndef _GVT_CMD_PARSER_H_
 #define _GVT_CMD_PARSER_H_
 
-#define GVT_CMD_HASH_BITS 7
+#define GVT_CMD_TYPE_NUM 8
+
+struct cmd_info;
+
+/*
+ * Direct lookup table for one command type on one ring. It is indexed by
+ * the opcode bits that follow the 3-bit command type, so decoding a command
+ * header is a shift, a mask and a load.
+ */
+struct intel_gvt_cmd_table {
+	struct cmd_info **entries;
+	unsigned int shift;
+	unsigned int mask;
+};
+
+#define GVT_BB_CACHE_HASH_BITS 5
+
+/*
+ * Per-vGPU cache of first level batch buffers that have already been
+ * audited, keyed by a hash of their contents. See bb_cache_lookup().
+ */
+struct intel_vgpu_bb_cache {
+	struct mutex lock;
+	DECLARE_HASHTABLE(table, GVT_BB_CACHE_HASH_BITS);
+	struct list_head lru;
+	unsigned int nr_entries;
+};
+
+void intel_vgpu_init_bb_cache(struct intel_vgpu *vgpu);
+
+void intel_vgpu_clean_bb_cache(struct intel_vgpu *vgpu);
 
 void intel_gvt_clean_cmd_parser(struct intel_gvt *gvt);
 
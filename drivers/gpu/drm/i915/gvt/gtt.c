@@ -45,7 +45,8 @@
 #endif
 
 static bool enable_out_of_sync = true;
-static int preallocated_oos_pages = 2048;
+/* upper bound of oos pages a single vGPU may hold */
+static unsigned int vgpu_oos_page_budget = 512;
 
 /*
  * validate a gm address and related range size,
@@ -1409,25 +1410,41 @@ static int sync_oos_page(struct intel_vgpu *vgpu,
 	struct intel_gvt *gvt = vgpu->gvt;
 	struct intel_gvt_gtt_pte_ops *ops = gvt->gtt.pte_ops;
 	struct intel_vgpu_ppgtt_spt *spt = oos_page->spt;
-	struct intel_gvt_gtt_entry old, new;
-	int index;
+	DECLARE_BITMAP(dirty, GTT_ENTRY_NUM_IN_ONE_PAGE);
+	unsigned long nr_entries = I915_GTT_PAGE_SIZE >>
+				   info->gtt_entry_size_shift;
+	u64 *old = (u64 *)oos_page->mem;
+	u64 *cur = vgpu->gtt.oos_sync_buf;
+	struct intel_gvt_gtt_entry new;
+	unsigned long index;
 	int ret;
 
 	trace_oos_change(vgpu->id, "sync", oos_page->id,
 			 spt, spt->guest_page.type);
 
-	old.type = new.type = get_entry_type(spt->guest_page.type);
-	old.val64 = new.val64 = 0;
+	/*
+	 * Snapshot the guest page with a single read and diff it against
+	 * the copy taken when the page went out of sync, so only entries
+	 * the guest actually changed, or that still wait for post shadowing,
+	 * are shadowed again.
+	 */
+	ret = intel_gvt_hypervisor_read_gpa(vgpu,
+			spt->guest_page.gfn << I915_GTT_PAGE_SHIFT,
+			cur, I915_GTT_PAGE_SIZE);
+	if (ret)
+		return ret;
 
-	for (index = 0; index < (I915_GTT_PAGE_SIZE >>
-				info->gtt_entry_size_shift); index++) {
-		ops->get_entry(oos_page->mem, &old, index, false, 0, vgpu);
-		ops->get_entry(NULL, &new, index, true,
-			       spt->guest_page.gfn << PAGE_SHIFT, vgpu);
+	bitmap_copy(dirty, spt->post_shadow_bitmap, nr_entries);
+	for (index = 0; index < nr_entries; index++) {
+		if (old[index] != cur[index])
+			__set_bit(index, dirty);
+	}
 
-		if (old.val64 == new.val64
-			&& !test_and_clear_bit(index, spt->post_shadow_bitmap))
-			continue;
+	new.type = get_entry_type(spt->guest_page.type);
+	new.val64 = 0;
+
+	for_each_set_bit(index, dirty, nr_entries) {
+		ops->get_entry(cur, &new, index, false, 0, vgpu);
 
 		trace_oos_sync(vgpu->id, oos_page->id,
 				spt, spt->guest_page.type,
@@ -1438,6 +1455,8 @@ static int sync_oos_page(struct intel_vgpu *vgpu,
 			return ret;
 
 		ops->set_entry(oos_page->mem, &new, index, false, 0, vgpu);
+		/* only drop the pending entry once it has been shadowed */
+		__clear_bit(index, spt->post_shadow_bitmap);
 	}
 
 	spt->guest_page.write_cnt = 0;
@@ -1448,7 +1467,6 @@ static int sync_oos_page(struct intel_vgpu *vgpu,
 static int detach_oos_page(struct intel_vgpu *vgpu,
 		struct intel_vgpu_oos_page *oos_page)
 {
-	struct intel_gvt *gvt = vgpu->gvt;
 	struct intel_vgpu_ppgtt_spt *spt = oos_page->spt;
 
 	trace_oos_change(vgpu->id, "detach", oos_page->id,
@@ -1459,7 +1477,7 @@ static int detach_oos_page(struct intel_vgpu *vgpu,
 	oos_page->spt = NULL;
 
 	list_del_init(&oos_page->vm_list);
-	list_move_tail(&oos_page->list, &gvt->gtt.oos_page_free_list_head);
+	list_move_tail(&oos_page->list, &vgpu->gtt.oos_page_free_list_head);
 
 	return 0;
 }
@@ -1467,10 +1485,10 @@ static int detach_oos_page(struct intel_vgpu *vgpu,
 static int attach_oos_page(struct intel_vgpu_oos_page *oos_page,
 		struct intel_vgpu_ppgtt_spt *spt)
 {
-	struct intel_gvt *gvt = spt->vgpu->gvt;
+	struct intel_vgpu *vgpu = spt->vgpu;
 	int ret;
 
-	ret = intel_gvt_hypervisor_read_gpa(spt->vgpu,
+	ret = intel_gvt_hypervisor_read_gpa(vgpu,
 			spt->guest_page.gfn << I915_GTT_PAGE_SHIFT,
 			oos_page->mem, I915_GTT_PAGE_SIZE);
 	if (ret)
@@ -1479,9 +1497,9 @@ static int attach_oos_page(struct intel_vgpu_oos_page *oos_page,
 	oos_page->spt = spt;
 	spt->guest_page.oos_page = oos_page;
 
-	list_move_tail(&oos_page->list, &gvt->gtt.oos_page_use_list_head);
+	list_move_tail(&oos_page->list, &vgpu->gtt.oos_page_use_list_head);
 
-	trace_oos_change(spt->vgpu->id, "attach", oos_page->id,
+	trace_oos_change(vgpu->id, "attach", oos_page->id,
 			 spt, spt->guest_page.type);
 	return 0;
 }
@@ -1502,27 +1520,43 @@ static int ppgtt_set_guest_page_sync(struct intel_vgpu_ppgtt_spt *spt)
 	return sync_oos_page(spt->vgpu, oos_page);
 }
 
+/*
+ * Each vGPU draws oos pages from its own pool, which grows on demand up to
+ * vgpu_oos_page_budget. Once the budget is used up the least recently
+ * written oos page of the same vGPU is synced and reused, so a busy guest
+ * can only ever recycle its own out-of-sync slots.
+ */
 static int ppgtt_allocate_oos_page(struct intel_vgpu_ppgtt_spt *spt)
 {
-	struct intel_gvt *gvt = spt->vgpu->gvt;
-	struct intel_gvt_gtt *gtt = &gvt->gtt;
+	struct intel_vgpu_gtt *gtt = &spt->vgpu->gtt;
 	struct intel_vgpu_oos_page *oos_page = spt->guest_page.oos_page;
 	int ret;
 
 	WARN(oos_page, "shadow PPGTT page has already has a oos page\n");
 
-	if (list_empty(&gtt->oos_page_free_list_head)) {
-		oos_page = container_of(gtt->oos_page_use_list_head.next,
-			struct intel_vgpu_oos_page, list);
+	if (!list_empty(&gtt->oos_page_free_list_head)) {
+		oos_page = list_first_entry(&gtt->oos_page_free_list_head,
+				struct intel_vgpu_oos_page, list);
+	} else if (gtt->nr_oos_pages < vgpu_oos_page_budget &&
+		   (oos_page = kmalloc(sizeof(*oos_page), GFP_KERNEL))) {
+		INIT_LIST_HEAD(&oos_page->list);
+		INIT_LIST_HEAD(&oos_page->vm_list);
+		oos_page->spt = NULL;
+		oos_page->id = gtt->nr_oos_pages++;
+		list_add_tail(&oos_page->list, &gtt->oos_page_free_list_head);
+	} else {
+		if (list_empty(&gtt->oos_page_use_list_head))
+			return -ENOMEM;
+
+		oos_page = list_first_entry(&gtt->oos_page_use_list_head,
+				struct intel_vgpu_oos_page, list);
 		ret = ppgtt_set_guest_page_sync(oos_page->spt);
 		if (ret)
 			return ret;
 		ret = detach_oos_page(spt->vgpu, oos_page);
 		if (ret)
 			return ret;
-	} else
-		oos_page = container_of(gtt->oos_page_free_list_head.next,
-			struct intel_vgpu_oos_page, list);
+	}
 	return attach_oos_page(oos_page, spt);
 }
 
@@ -1845,13 +1879,19 @@ static int ppgtt_handle_guest_write_page_table_bytes(
 
 	spt->guest_page.write_cnt++;
 
-	if (spt->guest_page.oos_page)
+	if (spt->guest_page.oos_page) {
 		ops->set_entry(spt->guest_page.oos_page->mem, &we, index,
 				false, 0, vgpu);
+		/* keep the most recently written pages out of reclaim */
+		list_move_tail(&spt->guest_page.oos_page->list,
+			       &vgpu->gtt.oos_page_use_list_head);
+	}
 
 	if (can_do_out_of_sync(spt)) {
-		if (!spt->guest_page.oos_page)
-			ppgtt_allocate_oos_page(spt);
+		/* without an oos page the spt simply stays write protected */
+		if (!spt->guest_page.oos_page &&
+		    ppgtt_allocate_oos_page(spt))
+			return 0;
 
 		ret = ppgtt_set_guest_page_oos(spt);
 		if (ret < 0)
@@ -2610,11 +2650,15 @@ static int create_scratch_page_tree(struct intel_vgpu *vgpu)
 int intel_vgpu_init_gtt(struct intel_vgpu *vgpu)
 {
 	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
+	int ret;
 
 	INIT_RADIX_TREE(&gtt->spt_tree, GFP_KERNEL);
 
 	INIT_LIST_HEAD(&gtt->ppgtt_mm_list_head);
 	INIT_LIST_HEAD(&gtt->oos_page_list_head);
+	INIT_LIST_HEAD(&gtt->oos_page_use_list_head);
+	INIT_LIST_HEAD(&gtt->oos_page_free_list_head);
+	gtt->nr_oos_pages = 0;
 	INIT_LIST_HEAD(&gtt->post_shadow_list_head);
 
 	gtt->ggtt_mm = intel_vgpu_create_ggtt_mm(vgpu);
@@ -2628,11 +2672,36 @@ int intel_vgpu_init_gtt(struct intel_vgpu *vgpu)
 	vgpu->cached_guest_entry = kzalloc(I915_GTT_PAGE_SIZE, GFP_KERNEL);
 	if (!vgpu->cached_guest_entry) {
 		gvt_vgpu_err("fail to allocate cached_guest_entry page\n");
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto err_ggtt_mm;
 	}
 	vgpu->ge_cache_enable = false;
 
-	return create_scratch_page_tree(vgpu);
+	if (enable_out_of_sync) {
+		gtt->oos_sync_buf = kmalloc(I915_GTT_PAGE_SIZE, GFP_KERNEL);
+		if (!gtt->oos_sync_buf) {
+			gvt_vgpu_err("fail to allocate oos sync page\n");
+			ret = -ENOMEM;
+			goto err_cached_guest_entry;
+		}
+	}
+
+	ret = create_scratch_page_tree(vgpu);
+	if (ret)
+		goto err_oos_sync_buf;
+
+	return 0;
+
+err_oos_sync_buf:
+	kfree(gtt->oos_sync_buf);
+	gtt->oos_sync_buf = NULL;
+err_cached_guest_entry:
+	kfree(vgpu->cached_guest_entry);
+	vgpu->cached_guest_entry = NULL;
+err_ggtt_mm:
+	intel_vgpu_destroy_mm(gtt->ggtt_mm);
+	gtt->ggtt_mm = NULL;
+	return ret;
 }
 
 static void intel_vgpu_destroy_all_ppgtt_mm(struct intel_vgpu *vgpu)
@@ -2660,6 +2729,25 @@ static void intel_vgpu_destroy_ggtt_mm(struct intel_vgpu *vgpu)
 	vgpu->gtt.ggtt_mm = NULL;
 }
 
+static void clean_spt_oos(struct intel_vgpu *vgpu)
+{
+	struct intel_vgpu_gtt *gtt = &vgpu->gtt;
+	struct intel_vgpu_oos_page *oos_page, *n;
+
+	WARN(!list_empty(&gtt->oos_page_use_list_head),
+		"someone is still using oos page\n");
+
+	list_for_each_entry_safe(oos_page, n, &gtt->oos_page_free_list_head,
+				 list) {
+		list_del(&oos_page->list);
+		kfree(oos_page);
+	}
+	gtt->nr_oos_pages = 0;
+
+	kfree(gtt->oos_sync_buf);
+	gtt->oos_sync_buf = NULL;
+}
+
 /**
  * intel_vgpu_clean_gtt - clean up per-vGPU graphics memory virulization
  * @vgpu: a vGPU
@@ -2674,57 +2762,11 @@ void intel_vgpu_clean_gtt(struct intel_vgpu *vgpu)
 {
 	intel_vgpu_destroy_all_ppgtt_mm(vgpu);
 	intel_vgpu_destroy_ggtt_mm(vgpu);
+	clean_spt_oos(vgpu);
 	kfree(vgpu->cached_guest_entry);
 	release_scratch_page_tree(vgpu);
 }
 
-static void clean_spt_oos(struct intel_gvt *gvt)
-{
-	struct intel_gvt_gtt *gtt = &gvt->gtt;
-	struct list_head *pos, *n;
-	struct intel_vgpu_oos_page *oos_page;
-
-	WARN(!list_empty(&gtt->oos_page_use_list_head),
-		"someone is still using oos page\n");
-
-	list_for_each_safe(pos, n, &gtt->oos_page_free_list_head) {
-		oos_page = container_of(pos, struct intel_vgpu_oos_page, list);
-		list_del(&oos_page->list);
-		kfree(oos_page);
-	}
-}
-
-static int setup_spt_oos(struct intel_gvt *gvt)
-{
-	struct intel_gvt_gtt *gtt = &gvt->gtt;
-	struct intel_vgpu_oos_page *oos_page;
-	int i;
-	int ret;
-
-	INIT_LIST_HEAD(&gtt->oos_page_free_list_head);
-	INIT_LIST_HEAD(&gtt->oos_page_use_list_head);
-
-	for (i = 0; i < preallocated_oos_pages; i++) {
-		oos_page = kmalloc(sizeof(*oos_page), GFP_KERNEL);
-		if (!oos_page) {
-			ret = -ENOMEM;
-			goto fail;
-		}
-
-		INIT_LIST_HEAD(&oos_page->list);
-		INIT_LIST_HEAD(&oos_page->vm_list);
-		oos_page->id = i;
-		list_add_tail(&oos_page->list, &gtt->oos_page_free_list_head);
-	}
-
-	gvt_dbg_mm("%d oos pages preallocated\n", i);
-
-	return 0;
-fail:
-	clean_spt_oos(gvt);
-	return ret;
-}
-
 /**
  * intel_vgpu_find_ppgtt_mm - find a PPGTT mm object
  * @vgpu: a vGPU
@@ -2824,7 +2866,6 @@ int intel_vgpu_put_ppgtt_mm(struct intel_vgpu *vgpu, u64 pdps[])
  */
 int intel_gvt_init_gtt(struct intel_gvt *gvt)
 {
-	int ret;
 	void *page;
 	struct device *dev = &gvt->dev_priv->drm.pdev->dev;
 	dma_addr_t daddr;
@@ -2851,15 +2892,6 @@ int intel_gvt_init_gtt(struct intel_gvt *gvt)
 	gvt->gtt.scratch_page = virt_to_page(page);
 	gvt->gtt.scratch_mfn = (unsigned long)(daddr >> I915_GTT_PAGE_SHIFT);
 
-	if (enable_out_of_sync) {
-		ret = setup_spt_oos(gvt);
-		if (ret) {
-			gvt_err("fail to initialize SPT oos\n");
-			dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
-			__free_page(gvt->gtt.scratch_page);
-			return ret;
-		}
-	}
 	INIT_LIST_HEAD(&gvt->gtt.ppgtt_mm_lru_list_head);
 	return 0;
 }
@@ -2881,9 +2913,6 @@ void intel_gvt_clean_gtt(struct intel_gvt *gvt)
 	dma_unmap_page(dev, daddr, 4096, PCI_DMA_BIDIRECTIONAL);
 
 	__free_page(gvt->gtt.scratch_page);
-
-	if (enable_out_of_sync)
-		clean_spt_oos(gvt);
 }
 
 /**
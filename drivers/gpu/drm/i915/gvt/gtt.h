@@ -86,8 +86,6 @@ struct intel_gvt_gtt {
 	struct intel_gvt_gtt_gma_ops *gma_ops;
 	int (*mm_alloc_page_table)(struct intel_vgpu_mm *mm);
 	void (*mm_free_page_table)(struct intel_vgpu_mm *mm);
-	struct list_head oos_page_use_list_head;
-	struct list_head oos_page_free_list_head;
 	struct list_head ppgtt_mm_lru_list_head;
 
 	struct page *scratch_page;
@@ -196,6 +194,12 @@ struct intel_vgpu_gtt {
 	struct list_head ppgtt_mm_list_head;
 	struct radix_tree_root spt_tree;
 	struct list_head oos_page_list_head;
+	/* oos pages attached to spts of this vGPU, in LRU order */
+	struct list_head oos_page_use_list_head;
+	struct list_head oos_page_free_list_head;
+	unsigned int nr_oos_pages;
+	/* guest page snapshot used when syncing an oos page */
+	void *oos_sync_buf;
 	struct list_head post_shadow_list_head;
 	struct intel_vgpu_scratch_pt scratch_pt[GTT_TYPE_MAX];
 
@@ -46,16 +46,26 @@ static bool vgpu_has_pending_workload(struct intel_vgpu *vgpu,
 /* We give 2 seconds higher prio for vGPU during start */
 #define GVT_SCHED_VGPU_PRI_TIME  2
 
+/*
+ * Virtual time advances by the real time a vGPU occupies a ring, scaled by
+ * GVT_SCHED_VTIME_WEIGHT / weight, so heavier vGPUs age more slowly and get
+ * a proportionally larger share of the ring.
+ */
+#define GVT_SCHED_VTIME_WEIGHT	16
+
 struct vgpu_sched_data {
-	struct list_head lru_list;
+	/* on gvt_sched_data.runq while the vGPU has pending workload */
+	struct rb_node rb_node;
+	bool queued;
+	/* on gvt_sched_data.pri_runq during the start up boost */
+	struct list_head pri_list;
 	struct intel_vgpu *vgpu;
 	bool active;
 	bool pri_sched;
 	ktime_t pri_time;
 	ktime_t sched_in_time;
 	ktime_t sched_time;
-	ktime_t left_ts;
-	ktime_t allocated_ts;
+	u64 vtime;
 
 	struct vgpu_sched_ctl sched_ctl;
 };
@@ -64,67 +74,80 @@ struct gvt_sched_data {
 	struct intel_gvt *gvt;
 	struct hrtimer timer;
 	unsigned long period;
-	struct list_head lru_runq_head[I915_NUM_ENGINES];
-	ktime_t expire_time;
+	/* runnable vGPUs ordered by virtual time, per ring */
+	struct rb_root_cached runq[I915_NUM_ENGINES];
+	struct list_head pri_runq[I915_NUM_ENGINES];
+	u64 min_vtime[I915_NUM_ENGINES];
+	unsigned int nr_active;
 };
 
+static void vgpu_runq_insert(struct gvt_sched_data *sched_data,
+			     struct vgpu_sched_data *vgpu_data,
+			     enum intel_engine_id ring_id)
+{
+	struct rb_root_cached *root = &sched_data->runq[ring_id];
+	struct rb_node **link = &root->rb_root.rb_node, *parent = NULL;
+	struct vgpu_sched_data *entry;
+	bool leftmost = true;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct vgpu_sched_data, rb_node);
+		if (vgpu_data->vtime < entry->vtime) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+
+	rb_link_node(&vgpu_data->rb_node, parent, link);
+	rb_insert_color_cached(&vgpu_data->rb_node, root, leftmost);
+	vgpu_data->queued = true;
+}
+
+static void vgpu_runq_remove(struct gvt_sched_data *sched_data,
+			     struct vgpu_sched_data *vgpu_data,
+			     enum intel_engine_id ring_id)
+{
+	if (!vgpu_data->queued)
+		return;
+
+	rb_erase_cached(&vgpu_data->rb_node, &sched_data->runq[ring_id]);
+	vgpu_data->queued = false;
+}
+
 static void vgpu_update_timeslice(struct intel_vgpu *vgpu, ktime_t cur_time,
 				enum intel_engine_id ring_id)
 {
-	ktime_t delta_ts;
+	struct gvt_sched_data *sched_data;
 	struct vgpu_sched_data *vgpu_data;
+	ktime_t delta_ts;
+	bool queued;
 
 	if (!vgpu || vgpu == vgpu->gvt->idle_vgpu)
 		return;
 
+	sched_data = vgpu->gvt->scheduler.sched_data;
 	vgpu_data = vgpu->sched_data[ring_id];
 	delta_ts = ktime_sub(cur_time, vgpu_data->sched_in_time);
 	vgpu_data->sched_time = ktime_add(vgpu_data->sched_time, delta_ts);
-	vgpu_data->left_ts = ktime_sub(vgpu_data->left_ts, delta_ts);
 	vgpu_data->sched_in_time = cur_time;
-}
-
-#define GVT_TS_BALANCE_PERIOD_MS 100
-#define GVT_TS_BALANCE_STAGE_NUM 10
 
-static void gvt_balance_timeslice(struct gvt_sched_data *sched_data,
-					enum intel_engine_id ring_id)
-{
-	struct vgpu_sched_data *vgpu_data;
-	struct list_head *pos;
-	static uint64_t stage_check[I915_NUM_ENGINES];
-	int stage = stage_check[ring_id]++ % GVT_TS_BALANCE_STAGE_NUM;
+	if (delta_ts <= 0)
+		return;
 
-	/* The timeslice accumulation reset at stage 0, which is
-	 * allocated again without adding previous debt.
-	 */
-	if (stage == 0) {
-		int total_weight = 0;
-		ktime_t fair_timeslice;
+	/* the key changes, so a queued node has to be repositioned */
+	queued = vgpu_data->queued;
+	if (queued)
+		vgpu_runq_remove(sched_data, vgpu_data, ring_id);
 
-		list_for_each(pos, &sched_data->lru_runq_head[ring_id]) {
-			vgpu_data = container_of(pos, struct vgpu_sched_data, lru_list);
-			total_weight += vgpu_data->sched_ctl.weight;
-		}
+	vgpu_data->vtime += div_u64(ktime_to_ns(delta_ts) *
+				    GVT_SCHED_VTIME_WEIGHT,
+				    vgpu_data->sched_ctl.weight);
 
-		list_for_each(pos, &sched_data->lru_runq_head[ring_id]) {
-			vgpu_data = container_of(pos, struct vgpu_sched_data, lru_list);
-			fair_timeslice = ktime_divns(ms_to_ktime(GVT_TS_BALANCE_PERIOD_MS),
-						     total_weight) * vgpu_data->sched_ctl.weight;
-
-			vgpu_data->allocated_ts = fair_timeslice;
-			vgpu_data->left_ts = vgpu_data->allocated_ts;
-		}
-	} else {
-		list_for_each(pos, &sched_data->lru_runq_head[ring_id]) {
-			vgpu_data = container_of(pos, struct vgpu_sched_data, lru_list);
-
-			/* timeslice for next 100ms should add the left/debt
-			 * slice of previous stages.
-			 */
-			vgpu_data->left_ts += vgpu_data->allocated_ts;
-		}
-	}
+	if (queued)
+		vgpu_runq_insert(sched_data, vgpu_data, ring_id);
 }
 
 static void try_to_schedule_next_vgpu(struct intel_gvt *gvt,
@@ -171,37 +194,57 @@ static void try_to_schedule_next_vgpu(struct intel_gvt *gvt,
 	wake_up(&scheduler->waitq[ring_id]);
 }
 
-static struct intel_vgpu *find_busy_vgpu(struct gvt_sched_data *sched_data,
-                                               enum intel_engine_id ring_id)
+static struct intel_vgpu *find_pri_vgpu(struct gvt_sched_data *sched_data,
+					 enum intel_engine_id ring_id)
 {
-	struct vgpu_sched_data *vgpu_data;
-	struct intel_vgpu *vgpu = NULL;
-	struct list_head *head = &sched_data->lru_runq_head[ring_id];
-	struct list_head *pos;
+	struct vgpu_sched_data *vgpu_data, *n;
+	ktime_t now;
 
-	/* search a vgpu with pending workload */
-	list_for_each(pos, head) {
+	if (list_empty(&sched_data->pri_runq[ring_id]))
+		return NULL;
 
-		vgpu_data = container_of(pos, struct vgpu_sched_data, lru_list);
-		if (!vgpu_has_pending_workload(vgpu_data->vgpu, ring_id))
+	now = ktime_get();
+	list_for_each_entry_safe(vgpu_data, n, &sched_data->pri_runq[ring_id],
+				 pri_list) {
+		if (!ktime_before(now, vgpu_data->pri_time)) {
+			vgpu_data->pri_sched = false;
+			list_del_init(&vgpu_data->pri_list);
 			continue;
-
-		if (vgpu_data->pri_sched) {
-			if (ktime_before(ktime_get(), vgpu_data->pri_time)) {
-				vgpu = vgpu_data->vgpu;
-				break;
-			} else
-				vgpu_data->pri_sched = false;
 		}
 
-		/* Return the vGPU only if it has time slice left */
-		if (vgpu_data->left_ts > 0) {
-			vgpu = vgpu_data->vgpu;
-			break;
+		if (vgpu_has_pending_workload(vgpu_data->vgpu, ring_id))
+			return vgpu_data->vgpu;
+	}
+	return NULL;
+}
+
+static struct intel_vgpu *find_busy_vgpu(struct gvt_sched_data *sched_data,
+                                               enum intel_engine_id ring_id)
+{
+	struct vgpu_sched_data *vgpu_data;
+	struct intel_vgpu *vgpu;
+	struct rb_node *node;
+
+	/* vGPUs still in their start up boost go first */
+	vgpu = find_pri_vgpu(sched_data, ring_id);
+	if (vgpu)
+		return vgpu;
+
+	/*
+	 * The leftmost vGPU has received the least weighted service. A vGPU
+	 * found without pending workload has gone idle: it leaves the runq
+	 * until new workload is queued, so each one is skipped at most once.
+	 */
+	while ((node = rb_first_cached(&sched_data->runq[ring_id]))) {
+		vgpu_data = rb_entry(node, struct vgpu_sched_data, rb_node);
+		if (vgpu_has_pending_workload(vgpu_data->vgpu, ring_id)) {
+			sched_data->min_vtime[ring_id] = vgpu_data->vtime;
+			return vgpu_data->vgpu;
 		}
+		vgpu_runq_remove(sched_data, vgpu_data, ring_id);
 	}
 
-	return vgpu;
+	return NULL;
 }
 
 /* in nanosecond */
@@ -212,27 +255,17 @@ static void tbs_sched_func(struct gvt_sched_data *sched_data,
 {
 	struct intel_gvt *gvt = sched_data->gvt;
 	struct intel_gvt_workload_scheduler *scheduler = &gvt->scheduler;
-	struct vgpu_sched_data *vgpu_data;
 	struct intel_vgpu *vgpu = NULL;
 
 	/* no active vgpu or has already had a target */
-	if (list_empty(&sched_data->lru_runq_head[ring_id])
-			|| scheduler->next_vgpu[ring_id])
+	if (!sched_data->nr_active || scheduler->next_vgpu[ring_id])
 		goto out;
 
 	vgpu = find_busy_vgpu(sched_data, ring_id);
-	if (vgpu) {
+	if (vgpu)
 		scheduler->next_vgpu[ring_id] = vgpu;
-		vgpu_data = vgpu->sched_data[ring_id];
-		if (!vgpu_data->pri_sched) {
-			/* Move the last used vGPU to the tail of lru_list */
-			list_del_init(&vgpu_data->lru_list);
-			list_add_tail(&vgpu_data->lru_list,
-				      &sched_data->lru_runq_head[ring_id]);
-		}
-	} else {
+	else
 		scheduler->next_vgpu[ring_id] = gvt->idle_vgpu;
-	}
 out:
 	if (scheduler->next_vgpu[ring_id])
 		try_to_schedule_next_vgpu(gvt, ring_id);
@@ -248,15 +281,7 @@ void intel_gvt_schedule(struct intel_gvt *gvt)
 	mutex_lock(&gvt->sched_lock);
 	cur_time = ktime_get();
 
-	if (test_and_clear_bit(INTEL_GVT_REQUEST_SCHED,
-				(void *)&gvt->service_request)) {
-		if (cur_time >= sched_data->expire_time) {
-			for_each_engine(engine, gvt->dev_priv, i)
-				gvt_balance_timeslice(sched_data, i);
-			sched_data->expire_time = ktime_add_ms(
-				cur_time, GVT_TS_BALANCE_PERIOD_MS);
-		}
-	}
+	clear_bit(INTEL_GVT_REQUEST_SCHED, (void *)&gvt->service_request);
 	clear_bit(INTEL_GVT_REQUEST_EVENT_SCHED, (void *)&gvt->service_request);
 
 	for_each_engine(engine, gvt->dev_priv, i) {
@@ -295,8 +320,10 @@ static int tbs_sched_init(struct intel_gvt *gvt)
 	if (!data)
 		return -ENOMEM;
 
-	for_each_engine(engine, gvt->dev_priv, i)
-		INIT_LIST_HEAD(&data->lru_runq_head[i]);
+	for_each_engine(engine, gvt->dev_priv, i) {
+		data->runq[i] = RB_ROOT_CACHED;
+		INIT_LIST_HEAD(&data->pri_runq[i]);
+	}
 
 	hrtimer_init(&data->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
 	data->timer.function = tbs_timer_fn;
@@ -331,9 +358,10 @@ static int tbs_sched_init_vgpu(struct intel_vgpu *vgpu)
 		if (!data)
 			goto err;
 
-		data->sched_ctl.weight = vgpu->sched_ctl.weight;
+		data->sched_ctl.weight = max(vgpu->sched_ctl.weight, 1);
 		data->vgpu = vgpu;
-		INIT_LIST_HEAD(&data->lru_list);
+		RB_CLEAR_NODE(&data->rb_node);
+		INIT_LIST_HEAD(&data->pri_list);
 
 		vgpu->sched_data[i] = data;
 	}
@@ -373,21 +401,31 @@ static void tbs_sched_start_schedule(struct intel_vgpu *vgpu)
 	struct vgpu_sched_data *vgpu_data;
 	enum intel_engine_id i;
 	struct intel_engine_cs *engine;
+	bool activated = false;
 
 	for_each_engine(engine, vgpu->gvt->dev_priv, i) {
 		vgpu_data = vgpu->sched_data[i];
-		if (!list_empty(&vgpu_data->lru_list))
+		if (vgpu_data->active)
 			continue;
 
 		now = ktime_get();
 		vgpu_data->pri_time = ktime_add(now,
 					ktime_set(GVT_SCHED_VGPU_PRI_TIME, 0));
 		vgpu_data->pri_sched = true;
+		list_add_tail(&vgpu_data->pri_list, &sched_data->pri_runq[i]);
 
-		list_add(&vgpu_data->lru_list, &sched_data->lru_runq_head[i]);
+		vgpu_data->vtime = sched_data->min_vtime[i];
 		vgpu_data->active = true;
+		activated = true;
+
+		/* workload queued before the start won't wake the vGPU */
+		if (!vgpu_data->queued && vgpu_has_pending_workload(vgpu, i))
+			vgpu_runq_insert(sched_data, vgpu_data, i);
 	}
 
+	if (activated)
+		sched_data->nr_active++;
+
 	if (!hrtimer_active(&sched_data->timer))
 		hrtimer_start(&sched_data->timer, ktime_add_ns(ktime_get(),
 			sched_data->period), HRTIMER_MODE_ABS);
@@ -395,16 +433,43 @@ static void tbs_sched_start_schedule(struct intel_vgpu *vgpu)
 
 static void tbs_sched_stop_schedule(struct intel_vgpu *vgpu)
 {
+	struct gvt_sched_data *sched_data = vgpu->gvt->scheduler.sched_data;
 	struct vgpu_sched_data *vgpu_data;
 	enum intel_engine_id i;
 	struct intel_engine_cs *engine;
+	bool was_active = false;
 
 	for_each_engine(engine, vgpu->gvt->dev_priv, i) {
 		vgpu_data = vgpu->sched_data[i];
 
-		list_del_init(&vgpu_data->lru_list);
+		was_active |= vgpu_data->active;
+		vgpu_runq_remove(sched_data, vgpu_data, i);
+		list_del_init(&vgpu_data->pri_list);
+		vgpu_data->pri_sched = false;
 		vgpu_data->active = false;
 	}
+
+	if (was_active)
+		sched_data->nr_active--;
+}
+
+static void tbs_sched_wake_vgpu(struct intel_vgpu *vgpu,
+				enum intel_engine_id ring_id)
+{
+	struct gvt_sched_data *sched_data = vgpu->gvt->scheduler.sched_data;
+	struct vgpu_sched_data *vgpu_data = vgpu->sched_data[ring_id];
+
+	if (!vgpu_data->active || vgpu_data->queued)
+		return;
+
+	/*
+	 * Don't let a vGPU bank service while it was idle, otherwise it
+	 * would monopolize the ring once it becomes busy again.
+	 */
+	if (vgpu_data->vtime < sched_data->min_vtime[ring_id])
+		vgpu_data->vtime = sched_data->min_vtime[ring_id];
+
+	vgpu_runq_insert(sched_data, vgpu_data, ring_id);
 }
 
 static struct intel_gvt_sched_policy_ops tbs_schedule_ops = {
@@ -414,6 +479,7 @@ static struct intel_gvt_sched_policy_ops tbs_schedule_ops = {
 	.clean_vgpu = tbs_sched_clean_vgpu,
 	.start_schedule = tbs_sched_start_schedule,
 	.stop_schedule = tbs_sched_stop_schedule,
+	.wake_vgpu = tbs_sched_wake_vgpu,
 };
 
 int intel_gvt_init_sched_policy(struct intel_gvt *gvt)
@@ -485,6 +551,24 @@ void intel_gvt_kick_schedule(struct intel_gvt *gvt)
 	mutex_unlock(&gvt->sched_lock);
 }
 
+/**
+ * intel_vgpu_kick_schedule - notify the scheduler of new vGPU workload
+ * @vgpu: a vGPU
+ * @ring_id: ring the workload was queued on
+ *
+ * Makes @vgpu runnable on @ring_id and kicks the scheduler.
+ */
+void intel_vgpu_kick_schedule(struct intel_vgpu *vgpu,
+			      enum intel_engine_id ring_id)
+{
+	struct intel_gvt *gvt = vgpu->gvt;
+
+	mutex_lock(&gvt->sched_lock);
+	gvt->scheduler.sched_ops->wake_vgpu(vgpu, ring_id);
+	intel_gvt_request_service(gvt, INTEL_GVT_REQUEST_EVENT_SCHED);
+	mutex_unlock(&gvt->sched_lock);
+}
+
 void intel_vgpu_stop_schedule(struct intel_vgpu *vgpu)
 {
 	struct intel_gvt_workload_scheduler *scheduler =
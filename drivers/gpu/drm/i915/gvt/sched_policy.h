@@ -41,6 +41,7 @@ struct intel_gvt_sched_policy_ops {
 	void (*clean_vgpu)(struct intel_vgpu *vgpu);
 	void (*start_schedule)(struct intel_vgpu *vgpu);
 	void (*stop_schedule)(struct intel_vgpu *vgpu);
+	void (*wake_vgpu)(struct intel_vgpu *vgpu, enum intel_engine_id ring_id);
 };
 
 void intel_gvt_schedule(struct intel_gvt *gvt);
@@ -59,4 +60,7 @@ void intel_vgpu_stop_schedule(struct intel_vgpu *vgpu);
 
 void intel_gvt_kick_schedule(struct intel_gvt *gvt);
 
+void intel_vgpu_kick_schedule(struct intel_vgpu *vgpu,
+			      enum intel_engine_id ring_id);
+
 #endif
@@ -372,6 +372,32 @@ static void release_shadow_wa_ctx(struct intel_shadow_wa_ctx *wa_ctx)
 
 	i915_gem_object_unpin_map(wa_ctx->indirect_ctx.obj);
 	i915_gem_object_put(wa_ctx->indirect_ctx.obj);
+	wa_ctx->indirect_ctx.obj = NULL;
+}
+
+static int scan_and_shadow_buffers(struct intel_vgpu_workload *workload)
+{
+	int ret;
+
+	if (workload->shadowed)
+		return 0;
+
+	ret = intel_gvt_scan_and_shadow_ringbuffer(workload);
+	if (ret)
+		return ret;
+
+	if ((workload->ring_id == RCS) &&
+	    (workload->wa_ctx.indirect_ctx.size != 0)
+	    && gvt_shadow_wa_ctx) {
+		ret = intel_gvt_scan_and_shadow_wa_ctx(&workload->wa_ctx);
+		if (ret) {
+			release_shadow_wa_ctx(&workload->wa_ctx);
+			return ret;
+		}
+	}
+
+	workload->shadowed = true;
+	return 0;
 }
 
 /**
@@ -418,18 +444,10 @@ int intel_gvt_scan_and_shadow_workload(struct intel_vgpu_workload *workload)
 	if (!test_and_set_bit(workload->ring_id, s->shadow_ctx_desc_updated))
 		shadow_context_descriptor_update(ce);
 
-	ret = intel_gvt_scan_and_shadow_ringbuffer(workload);
+	ret = scan_and_shadow_buffers(workload);
 	if (ret)
 		goto err_unpin;
 
-	if ((workload->ring_id == RCS) &&
-	    (workload->wa_ctx.indirect_ctx.size != 0)
-	    && gvt_shadow_wa_ctx) {
-		ret = intel_gvt_scan_and_shadow_wa_ctx(&workload->wa_ctx);
-		if (ret)
-			goto err_shadow;
-	}
-
 	rq = i915_request_alloc(engine, shadow_ctx);
 	if (IS_ERR(rq)) {
 		gvt_vgpu_err("fail to allocate gem request\n");
@@ -448,6 +466,7 @@ int intel_gvt_scan_and_shadow_workload(struct intel_vgpu_workload *workload)
 	i915_request_put(rq);
 err_shadow:
 	release_shadow_wa_ctx(&workload->wa_ctx);
+	workload->shadowed = false;
 err_unpin:
 	intel_context_unpin(ce);
 	return ret;
@@ -768,6 +787,47 @@ static int dispatch_workload(struct intel_vgpu_workload *workload)
 	return ret;
 }
 
+/*
+ * Scan and shadow the workload queued behind @workload while @workload
+ * executes, so the parser cost of the next submission is hidden behind GPU
+ * execution instead of adding to the gap between two requests.
+ *
+ * Only the ring buffer and wa ctx are handled here. The shadow ring buffer
+ * is free again once @workload has been copied into its request, but the
+ * shadow context is still in use by the engine, so allocating the request
+ * and populating the shadow context stay in dispatch_workload().
+ */
+static void prepare_next_workload(struct intel_vgpu_workload *workload)
+{
+	struct intel_vgpu *vgpu = workload->vgpu;
+	struct drm_i915_private *dev_priv = vgpu->gvt->dev_priv;
+	struct list_head *q = workload_q_head(vgpu, workload->ring_id);
+	struct intel_vgpu_workload *next;
+	int ret;
+
+	mutex_lock(&vgpu->vgpu_lock);
+
+	if (list_empty(&workload->list) || list_is_last(&workload->list, q))
+		goto out;
+
+	next = list_next_entry(workload, list);
+	if (next->shadowed || next->req)
+		goto out;
+
+	mutex_lock(&dev_priv->drm.struct_mutex);
+	ret = scan_and_shadow_buffers(next);
+	mutex_unlock(&dev_priv->drm.struct_mutex);
+
+	/*
+	 * Drop whatever was shadowed so far; the workload is scanned again
+	 * at dispatch, which reports the error through the normal path.
+	 */
+	if (ret)
+		release_shadow_batch_buffer(next);
+out:
+	mutex_unlock(&vgpu->vgpu_lock);
+}
+
 static struct intel_vgpu_workload *pick_next_workload(
 		struct intel_gvt *gvt, int ring_id)
 {
@@ -1082,6 +1142,8 @@ static int workload_thread(void *priv)
 			goto complete;
 		}
 
+		prepare_next_workload(workload);
+
 		gvt_dbg_sched("ring id %d wait workload %p\n",
 				workload->ring_id, workload);
 		lret = i915_request_wait(workload->req, 0,
@@ -1209,6 +1271,7 @@ void intel_vgpu_clean_submission(struct intel_vgpu *vgpu)
 	struct intel_vgpu_submission *s = &vgpu->submission;
 
 	intel_vgpu_select_submission_ops(vgpu, ALL_ENGINES, 0);
+	intel_vgpu_clean_bb_cache(vgpu);
 	i915_gem_context_put(s->shadow_ctx);
 	kmem_cache_destroy(s->workloads);
 }
@@ -1279,6 +1342,7 @@ int intel_vgpu_setup_submission(struct intel_vgpu *vgpu)
 
 	atomic_set(&s->running_workload_num, 0);
 	bitmap_zero(s->tlb_handle_pending, I915_NUM_ENGINES);
+	intel_vgpu_init_bb_cache(vgpu);
 
 	return 0;
 
@@ -1351,6 +1415,12 @@ void intel_vgpu_destroy_workload(struct intel_vgpu_workload *workload)
 {
 	struct intel_vgpu_submission *s = &workload->vgpu->submission;
 
+	/* queued workloads may have been shadowed ahead of dispatch */
+	if (workload->shadowed) {
+		release_shadow_batch_buffer(workload);
+		release_shadow_wa_ctx(&workload->wa_ctx);
+	}
+
 	if (workload->shadow_mm)
 		intel_vgpu_mm_put(workload->shadow_mm);
 
@@ -1530,8 +1600,10 @@ intel_vgpu_create_workload(struct intel_vgpu *vgpu, int ring_id,
 		return ERR_PTR(ret);
 	}
 
-	/* Only scan and shadow the first workload in the queue
-	 * as there is only one pre-allocated buf-obj for shadow.
+	/* Only scan and shadow the workload right away if the queue is
+	 * empty, as the per-ring scan buffer may still hold the shadow of
+	 * a queued one. Workloads queued behind others are shadowed by
+	 * prepare_next_workload() while the one ahead of them executes.
 	 */
 	if (list_empty(workload_q_head(vgpu, ring_id))) {
 		intel_runtime_pm_get(dev_priv);
@@ -1559,6 +1631,6 @@ void intel_vgpu_queue_workload(struct intel_vgpu_workload *workload)
 {
 	list_add_tail(&workload->list,
 		workload_q_head(workload->vgpu, workload->ring_id));
-	intel_gvt_kick_schedule(workload->vgpu->gvt);
+	intel_vgpu_kick_schedule(workload->vgpu, workload->ring_id);
 	wake_up(&workload->vgpu->gvt->scheduler.waitq[workload->ring_id]);
 }
@@ -88,6 +88,9 @@ struct intel_vgpu_workload {
 
 	struct intel_vgpu_mm *shadow_mm;
 
+	/* ring buffer and wa ctx have been scanned and shadowed */
+	bool shadowed;
+
 	/* different submission model may need different handler */
 	int (*prepare)(struct intel_vgpu_workload *);
 	int (*complete)(struct intel_vgpu_workload *);
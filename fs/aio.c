@@ -42,6 +42,11 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/cred.h>
+#include <linux/fdtable.h>
+#include <linux/sched/mm.h>
 
 #include <asm/kmap_types.h>
 #include <linux/uaccess.h>
@@ -111,6 +116,9 @@ struct kioctx {
 	 */
 	unsigned		max_reqs;
 
+	/* IOCTX_FLAG_* passed to io_setup() */
+	unsigned		flags;
+
 	/* Size of ringbuffer, in units of struct io_event */
 	unsigned		nr_events;
 
@@ -149,6 +157,25 @@ struct kioctx {
 		wait_queue_head_t wait;
 	} ____cacheline_aligned_in_smp;
 
+	struct {
+		spinlock_t	poll_lock;
+		struct list_head poll_reqs;	/* polled I/O in flight */
+	} ____cacheline_aligned_in_smp;
+
+	/* IOCTX_FLAG_SQRING submission ring */
+	struct {
+		struct mutex	sq_lock;
+		struct aio_sq_ring __user *sq_ring;
+		unsigned	sq_entries;
+		unsigned	sq_head;
+		unsigned	sq_flags;
+		bool		sq_compat;
+		struct task_struct *sq_thread;
+		struct mm_struct *sq_mm;
+		struct files_struct *sq_files;
+		const struct cred *sq_creds;
+	} ____cacheline_aligned_in_smp;
+
 	struct {
 		unsigned	tail;
 		unsigned	completed_events;
@@ -202,6 +229,7 @@ struct aio_kiocb {
 
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
+	struct list_head	ki_poll_list;	/* on ctx->poll_reqs */
 	refcount_t		ki_refcnt;
 
 	/*
@@ -581,6 +609,14 @@ static void free_ioctx(struct work_struct *work)
 					  free_rwork);
 	pr_debug("freeing %p\n", ctx);
 
+	if (ctx->sq_thread)
+		put_task_struct(ctx->sq_thread);
+	if (ctx->sq_files)
+		put_files_struct(ctx->sq_files);
+	if (ctx->sq_creds)
+		put_cred(ctx->sq_creds);
+	if (ctx->sq_mm)
+		mmdrop(ctx->sq_mm);
 	aio_free_ring(ctx);
 	free_percpu(ctx->cpu);
 	percpu_ref_exit(&ctx->reqs);
@@ -694,7 +730,7 @@ static void aio_nr_sub(unsigned nr)
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
-static struct kioctx *ioctx_alloc(unsigned nr_events)
+static struct kioctx *ioctx_alloc(unsigned nr_events, unsigned flags)
 {
 	struct mm_struct *mm = current->mm;
 	struct kioctx *ctx;
@@ -732,8 +768,11 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 		return ERR_PTR(-ENOMEM);
 
 	ctx->max_reqs = max_reqs;
+	ctx->flags = flags;
 
 	spin_lock_init(&ctx->ctx_lock);
+	spin_lock_init(&ctx->poll_lock);
+	mutex_init(&ctx->sq_lock);
 	spin_lock_init(&ctx->completion_lock);
 	mutex_init(&ctx->ring_lock);
 	/* Protect against page migration throughout kiotx setup by keeping
@@ -742,6 +781,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	init_waitqueue_head(&ctx->wait);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
+	INIT_LIST_HEAD(&ctx->poll_reqs);
 
 	if (percpu_ref_init(&ctx->users, free_ioctx_users, 0, GFP_KERNEL))
 		goto err;
@@ -827,6 +867,8 @@ static int kill_ioctx(struct mm_struct *mm, struct kioctx *ctx,
 
 	/* free_ioctx_reqs() will do the necessary RCU synchronization */
 	wake_up_all(&ctx->wait);
+	if (ctx->sq_thread)
+		wake_up_process(ctx->sq_thread);
 
 	/*
 	 * It'd be more correct to do this in free_ioctx(), after all
@@ -1030,6 +1072,7 @@ static inline struct aio_kiocb *aio_get_req(struct kioctx *ctx)
 	percpu_ref_get(&ctx->reqs);
 	req->ki_ctx = ctx;
 	INIT_LIST_HEAD(&req->ki_list);
+	INIT_LIST_HEAD(&req->ki_poll_list);
 	refcount_set(&req->ki_refcnt, 2);
 	req->ki_eventfd = NULL;
 	return req;
@@ -1071,12 +1114,11 @@ static inline void iocb_destroy(struct aio_kiocb *iocb)
 	kmem_cache_free(kiocb_cachep, iocb);
 }
 
-/* aio_complete
- *	Called when the io request on the given iocb is complete.
+/* aio_post_event
+ *	Add @ev to the completion ring of @ctx.
  */
-static void aio_complete(struct aio_kiocb *iocb)
+static void aio_post_event(struct kioctx *ctx, const struct io_event *ev)
 {
-	struct kioctx	*ctx = iocb->ki_ctx;
 	struct aio_ring	*ring;
 	struct io_event	*ev_page, *event;
 	unsigned tail, pos, head;
@@ -1098,14 +1140,14 @@ static void aio_complete(struct aio_kiocb *iocb)
 	ev_page = kmap_atomic(ctx->ring_pages[pos / AIO_EVENTS_PER_PAGE]);
 	event = ev_page + pos % AIO_EVENTS_PER_PAGE;
 
-	*event = iocb->ki_res;
+	*event = *ev;
 
 	kunmap_atomic(ev_page);
 	flush_dcache_page(ctx->ring_pages[pos / AIO_EVENTS_PER_PAGE]);
 
-	pr_debug("%p[%u]: %p: %p %Lx %Lx %Lx\n", ctx, tail, iocb,
-		 (void __user *)(unsigned long)iocb->ki_res.obj,
-		 iocb->ki_res.data, iocb->ki_res.res, iocb->ki_res.res2);
+	pr_debug("%p[%u]: %p %Lx %Lx %Lx\n", ctx, tail,
+		 (void __user *)(unsigned long)ev->obj,
+		 ev->data, ev->res, ev->res2);
 
 	/* after flagging the request as done, we
 	 * must never even look at it again
@@ -1125,18 +1167,11 @@ static void aio_complete(struct aio_kiocb *iocb)
 		refill_reqs_available(ctx, head, tail);
 	spin_unlock_irqrestore(&ctx->completion_lock, flags);
 
-	pr_debug("added to ring %p at [%u]\n", iocb, tail);
-
-	/*
-	 * Check if the user asked us to deliver the result through an
-	 * eventfd. The eventfd_signal() function is safe to be called
-	 * from IRQ context.
-	 */
-	if (iocb->ki_eventfd) {
-		eventfd_signal(iocb->ki_eventfd, 1);
-		eventfd_ctx_put(iocb->ki_eventfd);
-	}
+	pr_debug("added to ring at [%u]\n", tail);
+}
 
+static inline void aio_wake_waiters(struct kioctx *ctx)
+{
 	/*
 	 * We have to order our ring_info tail store above and test
 	 * of the wait list below outside the wait lock.  This is
@@ -1149,6 +1184,28 @@ static void aio_complete(struct aio_kiocb *iocb)
 		wake_up(&ctx->wait);
 }
 
+/* aio_complete
+ *	Called when the io request on the given iocb is complete.
+ */
+static void aio_complete(struct aio_kiocb *iocb)
+{
+	struct kioctx	*ctx = iocb->ki_ctx;
+
+	aio_post_event(ctx, &iocb->ki_res);
+
+	/*
+	 * Check if the user asked us to deliver the result through an
+	 * eventfd. The eventfd_signal() function is safe to be called
+	 * from IRQ context.
+	 */
+	if (iocb->ki_eventfd) {
+		eventfd_signal(iocb->ki_eventfd, 1);
+		eventfd_ctx_put(iocb->ki_eventfd);
+	}
+
+	aio_wake_waiters(ctx);
+}
+
 static inline void iocb_put(struct aio_kiocb *iocb)
 {
 	if (refcount_dec_and_test(&iocb->ki_refcnt)) {
@@ -1234,6 +1291,10 @@ static long aio_read_events_ring(struct kioctx *ctx,
 	kunmap_atomic(ring);
 	flush_dcache_page(ctx->ring_pages[0]);
 
+	/* a poller stalled on a full completion ring can go on now */
+	if (ctx->sq_thread && READ_ONCE(ctx->sq_flags) & AIO_SQ_NEED_WAKEUP)
+		wake_up_process(ctx->sq_thread);
+
 	pr_debug("%li  h%u t%u\n", ret, head, tail);
 out:
 	mutex_unlock(&ctx->ring_lock);
@@ -1258,12 +1319,108 @@ static bool aio_read_events(struct kioctx *ctx, long min_nr, long nr,
 	return ret < 0 || *i >= min_nr;
 }
 
+static inline bool aio_ctx_iopoll(struct kioctx *ctx)
+{
+	return ctx->flags & IOCTX_FLAG_IOPOLL;
+}
+
+/*
+ * The queue that decides whether direct I/O on @file can be polled, NULL if
+ * there is none.  Polling itself uses the queue recorded with the cookie.
+ */
+static struct request_queue *aio_iopoll_queue(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev;
+
+	if (S_ISBLK(inode->i_mode))
+		bdev = I_BDEV(inode);
+	else
+		bdev = inode->i_sb->s_bdev;
+	return bdev ? bdev_get_queue(bdev) : NULL;
+}
+
+/*
+ * Poll for the oldest polled request in flight and move it to the end of
+ * the list, so that requests on other hardware queues get their turn next
+ * time.  Completions found by blk_poll() are posted to the ring as usual.
+ * Returns false if there was nothing to poll for.
+ */
+static bool aio_iopoll(struct kioctx *ctx)
+{
+	struct aio_kiocb *iocb;
+	struct request_queue *q = NULL;
+	unsigned int cookie = BLK_QC_T_NONE;
+
+	spin_lock_irq(&ctx->poll_lock);
+	iocb = list_first_entry_or_null(&ctx->poll_reqs, struct aio_kiocb,
+					ki_poll_list);
+	if (iocb) {
+		list_move_tail(&iocb->ki_poll_list, &ctx->poll_reqs);
+		/* still holds the completion reference while on the list */
+		refcount_inc(&iocb->ki_refcnt);
+		q = READ_ONCE(iocb->rw.ki_poll_queue);
+		cookie = READ_ONCE(iocb->rw.ki_cookie);
+	}
+	spin_unlock_irq(&ctx->poll_lock);
+
+	if (!iocb)
+		return false;
+
+	/*
+	 * The bios of a multi-device filesystem may go to different queues
+	 * and the pair can be read halfway through an update, so make sure
+	 * the cookie names a hardware queue of @q before polling it.
+	 */
+	if (q && blk_qc_t_valid(cookie) &&
+	    blk_qc_t_to_queue_num(cookie) < q->nr_hw_queues)
+		blk_poll(q, cookie);
+	iocb_put(iocb);
+	return true;
+}
+
+/*
+ * read_events() for IOCTX_FLAG_IOPOLL contexts: spin on the device
+ * instead of sleeping until the completions show up in the ring.
+ */
+static long aio_iopoll_events(struct kioctx *ctx, long min_nr, long nr,
+			      struct io_event __user *event, ktime_t until)
+{
+	ktime_t end = until == KTIME_MAX ? KTIME_MAX :
+		      ktime_add(ktime_get(), until);
+	bool expired = false;
+	long ret = 0;
+
+	while (!aio_read_events(ctx, min_nr, nr, event, &ret) && !expired) {
+		if (!aio_iopoll(ctx)) {
+			/* nothing left to poll for, wait for the ring */
+			if (end != KTIME_MAX)
+				until = max_t(s64, ktime_sub(end, ktime_get()),
+					      0);
+			if (until)
+				wait_event_interruptible_hrtimeout(ctx->wait,
+					aio_read_events(ctx, min_nr, nr,
+							event, &ret),
+					until);
+			break;
+		}
+
+		expired = signal_pending(current) ||
+			  ktime_after(ktime_get(), end);
+		cond_resched();
+	}
+	return ret;
+}
+
 static long read_events(struct kioctx *ctx, long min_nr, long nr,
 			struct io_event __user *event,
 			ktime_t until)
 {
 	long ret = 0;
 
+	if (aio_ctx_iopoll(ctx))
+		return aio_iopoll_events(ctx, min_nr, nr, event, until);
+
 	/*
 	 * Note that aio_read_events() is being called as the conditional - i.e.
 	 * we're calling it after prepare_to_wait() has set task state to
@@ -1287,6 +1444,33 @@ static long read_events(struct kioctx *ctx, long min_nr, long nr,
 	return ret;
 }
 
+#define IOCTX_FLAGS	(IOCTX_FLAG_IOPOLL | IOCTX_FLAG_SQRING | IOCTX_FLAG_SQPOLL)
+
+static int aio_sq_setup(struct kioctx *ctx, unsigned long ring_addr);
+
+/*
+ * Split the IOCTX_FLAG_* bits off the nr_events argument of io_setup() and
+ * check them against the initial value of *ctxp, which must be 0 unless it
+ * is the address of a submission ring.
+ */
+static int aio_setup_flags(unsigned *nr_events, unsigned long ctx,
+			   unsigned *flags)
+{
+	*flags = *nr_events & IOCTX_FLAGS;
+	*nr_events &= ~IOCTX_FLAGS;
+
+	if ((*flags & IOCTX_FLAG_SQPOLL) && !(*flags & IOCTX_FLAG_SQRING))
+		return -EINVAL;
+	/* the poller spins on a CPU outside of the caller's cgroup and limits */
+	if ((*flags & IOCTX_FLAG_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!(*flags & IOCTX_FLAG_SQRING) != !ctx || *nr_events == 0) {
+		pr_debug("EINVAL: ctx %lu nr_events %u\n", ctx, *nr_events);
+		return -EINVAL;
+	}
+	return 0;
+}
+
 /* sys_io_setup:
  *	Create an aio_context capable of receiving at least nr_events.
  *	ctxp must not point to an aio_context that already exists, and
@@ -1298,29 +1482,34 @@ static long read_events(struct kioctx *ctx, long min_nr, long nr,
  *	of available events.  May fail with -ENOMEM if insufficient kernel
  *	resources are available.  May fail with -EFAULT if an invalid
  *	pointer is passed for ctxp.  Will fail with -ENOSYS if not
- *	implemented.
+ *	implemented.  The IOCTX_FLAG_* bits may be or'ed into nr_events:
+ *	with IOCTX_FLAG_IOPOLL reads and writes on the context are polled
+ *	for, see aio_iopoll_events(); with IOCTX_FLAG_SQRING *ctxp holds the
+ *	address of a submission ring on entry, see aio_sq_setup().
  */
 SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
 {
 	struct kioctx *ioctx = NULL;
 	unsigned long ctx;
+	unsigned flags;
 	long ret;
 
 	ret = get_user(ctx, ctxp);
 	if (unlikely(ret))
 		goto out;
 
-	ret = -EINVAL;
-	if (unlikely(ctx || nr_events == 0)) {
-		pr_debug("EINVAL: ctx %lu nr_events %u\n",
-		         ctx, nr_events);
+	ret = aio_setup_flags(&nr_events, ctx, &flags);
+	if (unlikely(ret))
 		goto out;
-	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, flags);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
-		ret = put_user(ioctx->user_id, ctxp);
+		ret = 0;
+		if (flags & IOCTX_FLAG_SQRING)
+			ret = aio_sq_setup(ioctx, ctx);
+		if (!ret)
+			ret = put_user(ioctx->user_id, ctxp);
 		if (ret)
 			kill_ioctx(current->mm, ioctx, NULL);
 		percpu_ref_put(&ioctx->users);
@@ -1335,24 +1524,26 @@ COMPAT_SYSCALL_DEFINE2(io_setup, unsigned, nr_events, u32 __user *, ctx32p)
 {
 	struct kioctx *ioctx = NULL;
 	unsigned long ctx;
+	unsigned flags;
 	long ret;
 
 	ret = get_user(ctx, ctx32p);
 	if (unlikely(ret))
 		goto out;
 
-	ret = -EINVAL;
-	if (unlikely(ctx || nr_events == 0)) {
-		pr_debug("EINVAL: ctx %lu nr_events %u\n",
-		         ctx, nr_events);
+	ret = aio_setup_flags(&nr_events, ctx, &flags);
+	if (unlikely(ret))
 		goto out;
-	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, flags);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
+		ret = 0;
+		if (flags & IOCTX_FLAG_SQRING)
+			ret = aio_sq_setup(ioctx, (unsigned long)compat_ptr(ctx));
 		/* truncating is ok because it's a user address */
-		ret = put_user((u32)ioctx->user_id, ctx32p);
+		if (!ret)
+			ret = put_user((u32)ioctx->user_id, ctx32p);
 		if (ret)
 			kill_ioctx(current->mm, ioctx, NULL);
 		percpu_ref_put(&ioctx->users);
@@ -1409,12 +1600,37 @@ static void aio_remove_iocb(struct aio_kiocb *iocb)
 	spin_unlock_irqrestore(&ctx->ctx_lock, flags);
 }
 
+static void aio_iopoll_add(struct kiocb *req)
+{
+	struct aio_kiocb *iocb = container_of(req, struct aio_kiocb, rw);
+	struct kioctx *ctx = iocb->ki_ctx;
+
+	if (!(req->ki_flags & IOCB_HIPRI))
+		return;
+
+	spin_lock_irq(&ctx->poll_lock);
+	list_add_tail(&iocb->ki_poll_list, &ctx->poll_reqs);
+	spin_unlock_irq(&ctx->poll_lock);
+}
+
+static void aio_iopoll_remove(struct aio_kiocb *iocb)
+{
+	struct kioctx *ctx = iocb->ki_ctx;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->poll_lock, flags);
+	list_del_init(&iocb->ki_poll_list);
+	spin_unlock_irqrestore(&ctx->poll_lock, flags);
+}
+
 static void aio_complete_rw(struct kiocb *kiocb, long res, long res2)
 {
 	struct aio_kiocb *iocb = container_of(kiocb, struct aio_kiocb, rw);
 
 	if (!list_empty_careful(&iocb->ki_list))
 		aio_remove_iocb(iocb);
+	if (!list_empty_careful(&iocb->ki_poll_list))
+		aio_iopoll_remove(iocb);
 
 	if (kiocb->ki_flags & IOCB_WRITE) {
 		struct inode *inode = file_inode(kiocb->ki_filp);
@@ -1435,6 +1651,7 @@ static void aio_complete_rw(struct kiocb *kiocb, long res, long res2)
 
 static int aio_prep_rw(struct kiocb *req, const struct iocb *iocb)
 {
+	struct kioctx *ctx = container_of(req, struct aio_kiocb, rw)->ki_ctx;
 	int ret;
 
 	req->ki_complete = aio_complete_rw;
@@ -1464,7 +1681,18 @@ static int aio_prep_rw(struct kiocb *req, const struct iocb *iocb)
 	if (unlikely(ret))
 		return ret;
 
-	req->ki_flags &= ~IOCB_HIPRI; /* no one is going to poll for this I/O */
+	if (aio_ctx_iopoll(ctx)) {
+		struct request_queue *q = aio_iopoll_queue(req->ki_filp);
+
+		if (!(req->ki_flags & IOCB_DIRECT) || !q || !q->poll_fn)
+			return -EOPNOTSUPP;
+		req->ki_flags |= IOCB_HIPRI;
+		req->ki_cookie = BLK_QC_T_NONE;
+		req->ki_poll_queue = NULL;
+	} else {
+		/* no one is going to poll for this I/O */
+		req->ki_flags &= ~IOCB_HIPRI;
+	}
 	return 0;
 }
 
@@ -1529,8 +1757,10 @@ static ssize_t aio_read(struct kiocb *req, const struct iocb *iocb,
 	if (ret)
 		return ret;
 	ret = rw_verify_area(READ, file, &req->ki_pos, iov_iter_count(&iter));
-	if (!ret)
+	if (!ret) {
+		aio_iopoll_add(req);
 		aio_rw_done(req, call_read_iter(file, req, &iter));
+	}
 	kfree(iovec);
 	return ret;
 }
@@ -1570,6 +1800,7 @@ static ssize_t aio_write(struct kiocb *req, const struct iocb *iocb,
 			__sb_writers_release(file_inode(file)->i_sb, SB_FREEZE_WRITE);
 		}
 		req->ki_flags |= IOCB_WRITE;
+		aio_iopoll_add(req);
 		aio_rw_done(req, call_write_iter(file, req, &iter));
 	}
 	kfree(iovec);
@@ -1787,6 +2018,17 @@ static int __io_submit_one(struct kioctx *ctx, const struct iocb *iocb,
 		return -EINVAL;
 	}
 
+	/* only reads and writes can be polled for */
+	if (aio_ctx_iopoll(ctx) &&
+	    iocb->aio_lio_opcode != IOCB_CMD_PREAD &&
+	    iocb->aio_lio_opcode != IOCB_CMD_PWRITE &&
+	    iocb->aio_lio_opcode != IOCB_CMD_PREADV &&
+	    iocb->aio_lio_opcode != IOCB_CMD_PWRITEV) {
+		pr_debug("EINVAL: operation %d on polled context\n",
+			 iocb->aio_lio_opcode);
+		return -EINVAL;
+	}
+
 	if (!get_reqs_available(ctx))
 		return -EAGAIN;
 
@@ -1885,6 +2127,257 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	return __io_submit_one(ctx, &iocb, user_iocb, compat);
 }
 
+/*
+ * Submission rings.  User space queues iocb pointers in a struct
+ * aio_sq_ring in its own memory; they are consumed by io_submit() with a
+ * NULL iocbpp or, with IOCTX_FLAG_SQPOLL, by a kernel thread that runs
+ * with the mm, files and credentials of the task that set up the context.
+ */
+#define AIO_SQ_MAX_ENTRIES	32768
+#define AIO_SQ_IDLE		HZ
+#define AIO_SQ_BATCH		64
+
+/*
+ * Report an iocb that could not be submitted through the completion ring,
+ * as there is no system call to return the error from.  The caller has
+ * reserved a ring slot for it.
+ */
+static void aio_sq_post_error(struct kioctx *ctx,
+			      struct iocb __user *user_iocb, long err)
+{
+	struct io_event ev = {
+		.obj	= (u64)(unsigned long)user_iocb,
+		.res	= err,
+	};
+
+	if (get_user(ev.data, &user_iocb->aio_data))
+		ev.data = 0;
+	aio_post_event(ctx, &ev);
+	aio_wake_waiters(ctx);
+}
+
+static int aio_sq_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb)
+{
+	int ret;
+
+	/* keep a ring slot for reporting a failure */
+	if (!get_reqs_available(ctx))
+		return -EAGAIN;
+
+	ret = io_submit_one(ctx, user_iocb, ctx->sq_compat);
+	if (!ret || ret == -EAGAIN) {
+		put_reqs_available(ctx, 1);
+		return ret;
+	}
+
+	aio_sq_post_error(ctx, user_iocb, ret);
+	return 0;
+}
+
+/*
+ * Submit up to @max entries from the submission ring.  Returns the number
+ * of entries consumed, or an error if there were none.  An -EAGAIN leaves
+ * the entry in the ring for the next attempt.
+ */
+static long aio_sq_submit(struct kioctx *ctx, long max)
+{
+	struct aio_sq_ring __user *ring = ctx->sq_ring;
+	unsigned mask = ctx->sq_entries - 1;
+	struct blk_plug plug;
+	unsigned head, tail;
+	long done = 0;
+	int ret = 0;
+
+	mutex_lock(&ctx->sq_lock);
+	head = ctx->sq_head;
+	if (get_user(tail, &ring->tail)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	/* read the entries only after the tail that covers them */
+	smp_rmb();
+
+	blk_start_plug_nr_ios(&plug, min_t(long, max, tail - head));
+	while (done < max && head != tail) {
+		u64 user_iocb;
+
+		if (get_user(user_iocb, &ring->iocbs[head & mask])) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = aio_sq_submit_one(ctx, u64_to_user_ptr(user_iocb));
+		if (ret)
+			break;
+		head++;
+		done++;
+	}
+	blk_finish_plug(&plug);
+
+	if (done) {
+		/* entries are consumed before user space may reuse them */
+		smp_mb();
+		ctx->sq_head = head;
+		if (put_user(head, &ring->head) && !ret)
+			ret = -EFAULT;
+	}
+out:
+	mutex_unlock(&ctx->sq_lock);
+	return done ? done : ret;
+}
+
+static bool aio_sq_pending(struct kioctx *ctx)
+{
+	unsigned tail;
+
+	if (get_user(tail, &ctx->sq_ring->tail))
+		return false;
+	return tail != READ_ONCE(ctx->sq_head);
+}
+
+static void aio_sq_set_flags(struct kioctx *ctx, unsigned flags)
+{
+	if (ctx->sq_flags == flags)
+		return;
+	ctx->sq_flags = flags;
+	put_user(flags, &ctx->sq_ring->flags);
+	/* order the flag update against the re-check of the tail */
+	smp_mb();
+}
+
+static int aio_sq_thread(void *data)
+{
+	struct kioctx *ctx = data;
+	const struct cred *old_cred = override_creds(ctx->sq_creds);
+	unsigned long idle_end = jiffies + AIO_SQ_IDLE;
+	struct files_struct *old_files;
+
+	task_lock(current);
+	old_files = current->files;
+	current->files = ctx->sq_files;
+	task_unlock(current);
+
+	while (!atomic_read(&ctx->dead)) {
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+
+		/*
+		 * The mm may only be gone if the context is being killed.
+		 * It stays attached for as long as the ring keeps us busy.
+		 */
+		if (mmget_not_zero(ctx->sq_mm)) {
+			use_mm(ctx->sq_mm);
+			while (!atomic_read(&ctx->dead)) {
+				long done;
+
+				aio_sq_set_flags(ctx, 0);
+				done = aio_sq_submit(ctx, AIO_SQ_BATCH);
+				if (done > 0)
+					idle_end = jiffies + AIO_SQ_IDLE;
+
+				if (done > 0 || (!done &&
+				    time_before(jiffies, idle_end))) {
+					cond_resched();
+					continue;
+				}
+
+				aio_sq_set_flags(ctx, AIO_SQ_NEED_WAKEUP);
+				set_current_state(TASK_INTERRUPTIBLE);
+				/*
+				 * Entries that failed to go in, e.g. on a
+				 * full completion ring, are retried once
+				 * events are reaped or after a while, not
+				 * spun on with the mm pinned.
+				 */
+				if (done < 0) {
+					timeout = AIO_SQ_IDLE;
+					break;
+				}
+				if (!aio_sq_pending(ctx))
+					break;
+				__set_current_state(TASK_RUNNING);
+			}
+			unuse_mm(ctx->sq_mm);
+			mmput_async(ctx->sq_mm);
+		} else {
+			set_current_state(TASK_INTERRUPTIBLE);
+		}
+
+		if (!atomic_read(&ctx->dead))
+			schedule_timeout(timeout);
+		__set_current_state(TASK_RUNNING);
+		idle_end = jiffies + AIO_SQ_IDLE;
+	}
+
+	task_lock(current);
+	current->files = old_files;
+	task_unlock(current);
+	revert_creds(old_cred);
+
+	/* taken by aio_sq_setup() */
+	percpu_ref_put(&ctx->users);
+	return 0;
+}
+
+/*
+ * Attach the user space submission ring at @ring_addr to a context being
+ * set up by io_setup(), and start its poller thread if asked for.
+ */
+static int aio_sq_setup(struct kioctx *ctx, unsigned long ring_addr)
+{
+	struct aio_sq_ring __user *ring = (void __user *)ring_addr;
+	struct task_struct *thread;
+	unsigned nr, head;
+
+	if (get_user(nr, &ring->nr) || get_user(head, &ring->head))
+		return -EFAULT;
+	if (!nr || !is_power_of_2(nr) || nr > AIO_SQ_MAX_ENTRIES)
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, ring, struct_size(ring, iocbs, nr)))
+		return -EFAULT;
+
+	ctx->sq_ring = ring;
+	ctx->sq_entries = nr;
+	ctx->sq_head = head;
+	ctx->sq_compat = in_compat_syscall();
+	if (put_user(0, &ring->flags))
+		return -EFAULT;
+
+	if (!(ctx->flags & IOCTX_FLAG_SQPOLL))
+		return 0;
+
+	mmgrab(current->mm);
+	ctx->sq_mm = current->mm;
+	ctx->sq_files = get_files_struct(current);
+	ctx->sq_creds = get_current_cred();
+
+	percpu_ref_get(&ctx->users);
+	thread = kthread_create(aio_sq_thread, ctx, "aio_sq/%d",
+				task_pid_nr(current));
+	if (IS_ERR(thread)) {
+		percpu_ref_put(&ctx->users);
+		return PTR_ERR(thread);
+	}
+	get_task_struct(thread);
+	ctx->sq_thread = thread;
+	wake_up_process(thread);
+	return 0;
+}
+
+/*
+ * io_submit() with a NULL iocbpp on a context with a submission ring:
+ * kick the poller thread, or submit up to @nr entries from the ring.
+ */
+static long aio_sq_enter(struct kioctx *ctx, long nr)
+{
+	if (!ctx->sq_ring)
+		return nr ? -EFAULT : 0;
+
+	if (ctx->sq_thread) {
+		wake_up_process(ctx->sq_thread);
+		return 0;
+	}
+	return nr ? aio_sq_submit(ctx, nr) : 0;
+}
+
 /* sys_io_submit:
  *	Queue the nr iocbs pointed to by iocbpp for processing.  Returns
  *	the number of iocbs queued.  May return -EINVAL if the aio_context
@@ -1895,7 +2388,9 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
  *	fail with -EBADF if the file descriptor specified in the first
  *	iocb is invalid.  May fail with -EAGAIN if insufficient resources
  *	are available to queue any iocbs.  Will return 0 if nr is 0.  Will
- *	fail with -ENOSYS if not implemented.
+ *	fail with -ENOSYS if not implemented.  With a NULL iocbpp, submits up
+ *	to nr entries from the submission ring of the context instead, or
+ *	wakes up its poller thread.
  */
 SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 		struct iocb __user * __user *, iocbpp)
@@ -1914,10 +2409,16 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 		return -EINVAL;
 	}
 
+	if (!iocbpp) {
+		ret = aio_sq_enter(ctx, nr);
+		percpu_ref_put(&ctx->users);
+		return ret;
+	}
+
 	if (nr > ctx->nr_events)
 		nr = ctx->nr_events;
 
-	blk_start_plug(&plug);
+	blk_start_plug_nr_ios(&plug, nr);
 	for (i = 0; i < nr; i++) {
 		struct iocb __user *user_iocb;
 
@@ -1954,10 +2455,16 @@ COMPAT_SYSCALL_DEFINE3(io_submit, compat_aio_context_t, ctx_id,
 		return -EINVAL;
 	}
 
+	if (!iocbpp) {
+		ret = aio_sq_enter(ctx, nr);
+		percpu_ref_put(&ctx->users);
+		return ret;
+	}
+
 	if (nr > ctx->nr_events)
 		nr = ctx->nr_events;
 
-	blk_start_plug(&plug);
+	blk_start_plug_nr_ios(&plug, nr);
 	for (i = 0; i < nr; i++) {
 		compat_uptr_t user_iocb;
 
@@ -411,8 +411,13 @@ __blkdev_direct_IO(struct kiocb *iocb, struct iov_iter *iter, int nr_pages)
 	}
 	blk_finish_plug(&plug);
 
-	if (!is_sync)
+	if (!is_sync) {
+		if (iocb->ki_flags & IOCB_HIPRI) {
+			WRITE_ONCE(iocb->ki_poll_queue, bdev_get_queue(bdev));
+			WRITE_ONCE(iocb->ki_cookie, qc);
+		}
 		return -EIOCBQUEUED;
+	}
 
 	for (;;) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
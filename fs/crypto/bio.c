@@ -26,17 +26,28 @@
 #include <linux/namei.h>
 #include "fscrypt_private.h"
 
-static void __fscrypt_decrypt_bio(struct bio *bio, bool done)
+/* Number of bio pages decrypted by one fscrypt_crypt_pages() call */
+#define FSCRYPT_BIO_BATCH	16
+
+/*
+ * Read bios of at least this many pages are split into FSCRYPT_BIO_BATCH
+ * sized chunks which are decrypted, and whose pages are unlocked, in
+ * parallel.
+ */
+#define FSCRYPT_BIO_SPLIT_PAGES	(2 * FSCRYPT_BIO_BATCH)
+
+static void fscrypt_decrypt_bio_pages(const struct inode *inode,
+				      struct fscrypt_page_op *ops,
+				      unsigned int nr, bool done)
 {
-	struct bio_vec *bv;
-	int i;
+	unsigned int i;
+
+	fscrypt_crypt_pages(inode, FS_DECRYPT, ops, nr, GFP_NOFS);
 
-	bio_for_each_segment_all(bv, bio, i) {
-		struct page *page = bv->bv_page;
-		int ret = fscrypt_decrypt_page(page->mapping->host, page,
-				PAGE_SIZE, 0, page->index);
+	for (i = 0; i < nr; i++) {
+		struct page *page = ops[i].dest_page;
 
-		if (ret) {
+		if (ops[i].err) {
 			WARN_ON_ONCE(1);
 			SetPageError(page);
 		} else if (done) {
@@ -47,9 +58,37 @@ static void __fscrypt_decrypt_bio(struct bio *bio, bool done)
 	}
 }
 
+static void fscrypt_decrypt_bvecs(struct bio_vec *bvecs, unsigned int count,
+				  bool done)
+{
+	struct fscrypt_page_op ops[FSCRYPT_BIO_BATCH];
+	struct inode *inode = NULL;
+	unsigned int nr = 0, i;
+
+	for (i = 0; i < count; i++) {
+		struct page *page = bvecs[i].bv_page;
+
+		if (nr == FSCRYPT_BIO_BATCH ||
+		    (nr && page->mapping->host != inode)) {
+			fscrypt_decrypt_bio_pages(inode, ops, nr, done);
+			nr = 0;
+		}
+
+		inode = page->mapping->host;
+		ops[nr].src_page = page;
+		ops[nr].dest_page = page;
+		ops[nr].lblk_num = page->index;
+		ops[nr].len = PAGE_SIZE;
+		ops[nr].offs = 0;
+		nr++;
+	}
+	if (nr)
+		fscrypt_decrypt_bio_pages(inode, ops, nr, done);
+}
+
 void fscrypt_decrypt_bio(struct bio *bio)
 {
-	__fscrypt_decrypt_bio(bio, false);
+	fscrypt_decrypt_bvecs(bio->bi_io_vec, bio->bi_vcnt, false);
 }
 EXPORT_SYMBOL(fscrypt_decrypt_bio);
 
@@ -58,17 +97,104 @@ static void completion_pages(struct work_struct *work)
 	struct fscrypt_ctx *ctx =
 		container_of(work, struct fscrypt_ctx, r.work);
 	struct bio *bio = ctx->r.bio;
+	int cpu = ctx->r.work_cpu;
 
-	__fscrypt_decrypt_bio(bio, true);
+	fscrypt_decrypt_bvecs(bio->bi_io_vec, bio->bi_vcnt, true);
 	fscrypt_release_ctx(ctx);
 	bio_put(bio);
+	fscrypt_decrypt_work_done(cpu);
+}
+
+struct fscrypt_bio_chunk {
+	struct work_struct work;
+	struct fscrypt_bio_job *job;
+	unsigned int start;
+	unsigned int nr;
+	int cpu;		/* per-CPU queue used, or -1 */
+};
+
+struct fscrypt_bio_job {
+	struct fscrypt_ctx *ctx;
+	struct bio *bio;
+	atomic_t remaining;
+	struct fscrypt_bio_chunk chunks[];
+};
+
+static void completion_chunk(struct work_struct *work)
+{
+	struct fscrypt_bio_chunk *chunk =
+		container_of(work, struct fscrypt_bio_chunk, work);
+	struct fscrypt_bio_job *job = chunk->job;
+	int cpu = chunk->cpu;
+
+	fscrypt_decrypt_bvecs(job->bio->bi_io_vec + chunk->start, chunk->nr,
+			      true);
+	if (atomic_dec_and_test(&job->remaining)) {
+		fscrypt_release_ctx(job->ctx);
+		bio_put(job->bio);
+		kfree(job);
+	}
+	fscrypt_decrypt_work_done(cpu);
+}
+
+/*
+ * Decrypt a large bio in chunks: the first one on the CPU that completed
+ * the bio, the second one on the CPU that submitted it and the rest
+ * wherever the unbound read workqueue finds an idle CPU.
+ */
+static bool fscrypt_enqueue_decrypt_chunks(struct fscrypt_ctx *ctx,
+					   struct bio *bio)
+{
+	unsigned int nr_chunks = DIV_ROUND_UP(bio->bi_vcnt, FSCRYPT_BIO_BATCH);
+	int this_cpu = raw_smp_processor_id();
+	struct fscrypt_bio_job *job;
+	unsigned int i;
+
+	job = kmalloc(struct_size(job, chunks, nr_chunks), GFP_ATOMIC);
+	if (!job)
+		return false;
+
+	job->ctx = ctx;
+	job->bio = bio;
+	atomic_set(&job->remaining, nr_chunks);
+	for (i = 0; i < nr_chunks; i++) {
+		struct fscrypt_bio_chunk *chunk = &job->chunks[i];
+
+		chunk->job = job;
+		chunk->start = i * FSCRYPT_BIO_BATCH;
+		chunk->nr = min_t(unsigned int, FSCRYPT_BIO_BATCH,
+				  bio->bi_vcnt - chunk->start);
+		chunk->cpu = -1;
+		INIT_WORK(&chunk->work, completion_chunk);
+	}
+
+	for (i = 0; i < nr_chunks; i++) {
+		struct fscrypt_bio_chunk *chunk = &job->chunks[i];
+
+		if (i == 0)
+			fscrypt_enqueue_decrypt_work_on(this_cpu, &chunk->work,
+							&chunk->cpu);
+		else if (i == 1 && ctx->submit_cpu != this_cpu &&
+			 cpu_online(ctx->submit_cpu))
+			fscrypt_enqueue_decrypt_work_on(ctx->submit_cpu,
+							&chunk->work,
+							&chunk->cpu);
+		else
+			fscrypt_enqueue_decrypt_work(&chunk->work);
+	}
+	return true;
 }
 
 void fscrypt_enqueue_decrypt_bio(struct fscrypt_ctx *ctx, struct bio *bio)
 {
+	if (bio->bi_vcnt >= FSCRYPT_BIO_SPLIT_PAGES &&
+	    fscrypt_enqueue_decrypt_chunks(ctx, bio))
+		return;
+
 	INIT_WORK(&ctx->r.work, completion_pages);
 	ctx->r.bio = bio;
-	fscrypt_enqueue_decrypt_work(&ctx->r.work);
+	fscrypt_enqueue_decrypt_work_on(raw_smp_processor_id(), &ctx->r.work,
+					&ctx->r.work_cpu);
 }
 EXPORT_SYMBOL(fscrypt_enqueue_decrypt_bio);
 
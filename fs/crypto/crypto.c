@@ -46,6 +46,7 @@ static LIST_HEAD(fscrypt_free_ctxs);
 static DEFINE_SPINLOCK(fscrypt_ctx_lock);
 
 static struct workqueue_struct *fscrypt_read_workqueue;
+static struct workqueue_struct *fscrypt_read_percpu_workqueue;
 static DEFINE_MUTEX(fscrypt_init_mutex);
 
 static struct kmem_cache *fscrypt_ctx_cachep;
@@ -57,6 +58,42 @@ void fscrypt_enqueue_decrypt_work(struct work_struct *work)
 }
 EXPORT_SYMBOL(fscrypt_enqueue_decrypt_work);
 
+/*
+ * Decryption work in flight on the per-CPU workqueue of each CPU.  When
+ * completions all land on one CPU, queueing more there than its worker
+ * keeps up with would serialize work that the unbound workqueue spreads
+ * across CPUs, so past FSCRYPT_LOCAL_DEPTH the work goes there instead.
+ */
+#define FSCRYPT_LOCAL_DEPTH	2
+static DEFINE_PER_CPU(atomic_t, fscrypt_local_depth);
+
+/*
+ * Queue read work on @cpu if its worker is not too busy, else on the
+ * unbound workqueue.  *@work_cpu is set before the work is queued, to
+ * what the work has to pass to fscrypt_decrypt_work_done() once done.
+ */
+void fscrypt_enqueue_decrypt_work_on(int cpu, struct work_struct *work,
+				     int *work_cpu)
+{
+	atomic_t *depth = per_cpu_ptr(&fscrypt_local_depth, cpu);
+
+	if (atomic_inc_return(depth) > FSCRYPT_LOCAL_DEPTH) {
+		atomic_dec(depth);
+		*work_cpu = -1;
+		fscrypt_enqueue_decrypt_work(work);
+		return;
+	}
+
+	*work_cpu = cpu;
+	queue_work_on(cpu, fscrypt_read_percpu_workqueue, work);
+}
+
+void fscrypt_decrypt_work_done(int cpu)
+{
+	if (cpu >= 0)
+		atomic_dec(per_cpu_ptr(&fscrypt_local_depth, cpu));
+}
+
 /**
  * fscrypt_release_ctx() - Releases an encryption context
  * @ctx: The encryption context to release.
@@ -129,64 +166,205 @@ struct fscrypt_ctx *fscrypt_get_ctx(const struct inode *inode, gfp_t gfp_flags)
 		ctx->flags &= ~FS_CTX_REQUIRES_FREE_ENCRYPT_FL;
 	}
 	ctx->flags &= ~FS_CTX_HAS_BOUNCE_BUFFER_FL;
+	ctx->submit_cpu = raw_smp_processor_id();
 	return ctx;
 }
 EXPORT_SYMBOL(fscrypt_get_ctx);
 
-int fscrypt_do_page_crypto(const struct inode *inode, fscrypt_direction_t rw,
-			   u64 lblk_num, struct page *src_page,
-			   struct page *dest_page, unsigned int len,
-			   unsigned int offs, gfp_t gfp_flags)
-{
+/*
+ * Every data unit has its own IV, so pages cannot share a cipher request.
+ * Instead the requests for up to a page worth of data units are carved out
+ * of a single buffer, submitted back to back and waited for once, which
+ * lets an asynchronous cipher work on all of them at the same time.  The
+ * buffer is kept in a per-CPU cache between calls.
+ */
+struct fscrypt_crypt_batch {
+	unsigned int size;
+	atomic_t pending;
+	struct completion done;
+};
+
+struct fscrypt_crypt_slot {
+	struct fscrypt_crypt_batch *batch;
+	struct fscrypt_page_op *op;
 	struct {
 		__le64 index;
 		u8 padding[FS_IV_SIZE - sizeof(__le64)];
 	} iv;
-	struct skcipher_request *req = NULL;
-	DECLARE_CRYPTO_WAIT(wait);
-	struct scatterlist dst, src;
-	struct fscrypt_info *ci = inode->i_crypt_info;
-	struct crypto_skcipher *tfm = ci->ci_ctfm;
-	int res = 0;
+	struct scatterlist src, dst;
+	/* must be last, followed by the tfm's request context */
+	struct skcipher_request req;
+};
+
+#define FSCRYPT_BATCH_HDR_SIZE \
+	ALIGN(sizeof(struct fscrypt_crypt_batch), CRYPTO_MINALIGN)
 
-	BUG_ON(len == 0);
+static DEFINE_PER_CPU(struct fscrypt_crypt_batch *, fscrypt_batch_cache);
+
+static struct fscrypt_crypt_batch *fscrypt_get_batch(unsigned int stride,
+						     gfp_t gfp_flags)
+{
+	unsigned int size = max_t(unsigned int, PAGE_SIZE,
+				  FSCRYPT_BATCH_HDR_SIZE + stride);
+	struct fscrypt_crypt_batch *batch;
+
+	batch = this_cpu_xchg(fscrypt_batch_cache, NULL);
+	if (batch && batch->size >= size)
+		return batch;
+	kfree(batch);
+
+	batch = kmalloc(size, gfp_flags);
+	if (!batch)
+		return NULL;
+	batch->size = size;
+	init_completion(&batch->done);
+	return batch;
+}
+
+static void fscrypt_put_batch(struct fscrypt_crypt_batch *batch)
+{
+	kfree(this_cpu_xchg(fscrypt_batch_cache, batch));
+}
+
+static void fscrypt_crypt_done(struct crypto_async_request *areq, int err)
+{
+	struct fscrypt_crypt_slot *slot = areq->data;
+	struct fscrypt_crypt_batch *batch = slot->batch;
+
+	/* a backlogged request has been started, wait for the real result */
+	if (err == -EINPROGRESS)
+		return;
+
+	slot->op->err = err;
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+static void fscrypt_submit_slot(const struct inode *inode,
+				fscrypt_direction_t rw,
+				struct fscrypt_crypt_slot *slot)
+{
+	struct fscrypt_info *ci = inode->i_crypt_info;
+	struct fscrypt_page_op *op = slot->op;
+	struct skcipher_request *req = &slot->req;
+	int res;
 
-	BUILD_BUG_ON(sizeof(iv) != FS_IV_SIZE);
+	BUILD_BUG_ON(sizeof(slot->iv) != FS_IV_SIZE);
 	BUILD_BUG_ON(AES_BLOCK_SIZE != FS_IV_SIZE);
-	iv.index = cpu_to_le64(lblk_num);
-	memset(iv.padding, 0, sizeof(iv.padding));
+	slot->iv.index = cpu_to_le64(op->lblk_num);
+	memset(slot->iv.padding, 0, sizeof(slot->iv.padding));
 
 	if (ci->ci_essiv_tfm != NULL) {
-		crypto_cipher_encrypt_one(ci->ci_essiv_tfm, (u8 *)&iv,
-					  (u8 *)&iv);
+		crypto_cipher_encrypt_one(ci->ci_essiv_tfm, (u8 *)&slot->iv,
+					  (u8 *)&slot->iv);
 	}
 
-	req = skcipher_request_alloc(tfm, gfp_flags);
-	if (!req)
-		return -ENOMEM;
-
+	skcipher_request_set_tfm(req, ci->ci_ctfm);
 	skcipher_request_set_callback(
 		req, CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
-		crypto_req_done, &wait);
+		fscrypt_crypt_done, slot);
+
+	sg_init_table(&slot->dst, 1);
+	sg_set_page(&slot->dst, op->dest_page, op->len, op->offs);
+	sg_init_table(&slot->src, 1);
+	sg_set_page(&slot->src, op->src_page, op->len, op->offs);
+	skcipher_request_set_crypt(req, &slot->src, &slot->dst, op->len,
+				   &slot->iv);
 
-	sg_init_table(&dst, 1);
-	sg_set_page(&dst, dest_page, len, offs);
-	sg_init_table(&src, 1);
-	sg_set_page(&src, src_page, len, offs);
-	skcipher_request_set_crypt(req, &src, &dst, len, &iv);
+	op->err = 0;
+	atomic_inc(&slot->batch->pending);
 	if (rw == FS_DECRYPT)
-		res = crypto_wait_req(crypto_skcipher_decrypt(req), &wait);
+		res = crypto_skcipher_decrypt(req);
 	else
-		res = crypto_wait_req(crypto_skcipher_encrypt(req), &wait);
-	skcipher_request_free(req);
-	if (res) {
-		fscrypt_err(inode->i_sb,
-			    "%scryption failed for inode %lu, block %llu: %d",
-			    (rw == FS_DECRYPT ? "de" : "en"),
-			    inode->i_ino, lblk_num, res);
-		return res;
+		res = crypto_skcipher_encrypt(req);
+	if (res != -EINPROGRESS && res != -EBUSY) {
+		/* completed synchronously, the callback is not called */
+		op->err = res;
+		atomic_dec(&slot->batch->pending);
 	}
-	return 0;
+}
+
+/**
+ * fscrypt_crypt_pages() - Encrypts or decrypts a set of pages of one inode
+ * @inode:     The inode the pages belong to.
+ * @rw:        FS_ENCRYPT or FS_DECRYPT.
+ * @ops:       The pages to process, see struct fscrypt_page_op.
+ * @nr:        Number of entries in @ops.
+ * @gfp_flags: The gfp flag for memory allocation.
+ *
+ * The result for each page is stored in its ->err.
+ *
+ * Return: Zero if all pages were processed successfully, else the first
+ * error.
+ */
+int fscrypt_crypt_pages(const struct inode *inode, fscrypt_direction_t rw,
+			struct fscrypt_page_op *ops, unsigned int nr,
+			gfp_t gfp_flags)
+{
+	struct crypto_skcipher *tfm = inode->i_crypt_info->ci_ctfm;
+	unsigned int stride, per_batch, i, j, n;
+	struct fscrypt_crypt_batch *batch;
+	int res = 0;
+
+	stride = ALIGN(sizeof(struct fscrypt_crypt_slot) +
+		       crypto_skcipher_reqsize(tfm), CRYPTO_MINALIGN);
+	batch = fscrypt_get_batch(stride, gfp_flags);
+	if (!batch) {
+		for (i = 0; i < nr; i++)
+			ops[i].err = -ENOMEM;
+		return -ENOMEM;
+	}
+	per_batch = (batch->size - FSCRYPT_BATCH_HDR_SIZE) / stride;
+
+	for (i = 0; i < nr; i += n) {
+		n = min(nr - i, per_batch);
+
+		atomic_set(&batch->pending, 1);
+		reinit_completion(&batch->done);
+		for (j = 0; j < n; j++) {
+			struct fscrypt_crypt_slot *slot = (void *)batch +
+				FSCRYPT_BATCH_HDR_SIZE + j * stride;
+
+			BUG_ON(ops[i + j].len == 0);
+			slot->batch = batch;
+			slot->op = &ops[i + j];
+			fscrypt_submit_slot(inode, rw, slot);
+		}
+		if (!atomic_dec_and_test(&batch->pending))
+			wait_for_completion(&batch->done);
+
+		for (j = 0; j < n; j++) {
+			struct fscrypt_page_op *op = &ops[i + j];
+
+			if (!op->err)
+				continue;
+			fscrypt_err(inode->i_sb,
+				    "%scryption failed for inode %lu, block %llu: %d",
+				    (rw == FS_DECRYPT ? "de" : "en"),
+				    inode->i_ino, op->lblk_num, op->err);
+			if (!res)
+				res = op->err;
+		}
+	}
+
+	fscrypt_put_batch(batch);
+	return res;
+}
+
+int fscrypt_do_page_crypto(const struct inode *inode, fscrypt_direction_t rw,
+			   u64 lblk_num, struct page *src_page,
+			   struct page *dest_page, unsigned int len,
+			   unsigned int offs, gfp_t gfp_flags)
+{
+	struct fscrypt_page_op op = {
+		.src_page = src_page,
+		.dest_page = dest_page,
+		.lblk_num = lblk_num,
+		.len = len,
+		.offs = offs,
+	};
+
+	return fscrypt_crypt_pages(inode, rw, &op, 1, gfp_flags);
 }
 
 struct page *fscrypt_alloc_bounce_page(struct fscrypt_ctx *ctx,
@@ -284,6 +462,99 @@ struct page *fscrypt_encrypt_page(const struct inode *inode,
 }
 EXPORT_SYMBOL(fscrypt_encrypt_page);
 
+/**
+ * fscrypt_encrypt_pages() - Encrypts a set of whole pages
+ * @inode:            The inode the pages belong to
+ * @pages:            The pages to encrypt.  Must be locked for bounce-page
+ *                    encryption.
+ * @ciphertext_pages: Receives the page holding the encrypted data of each
+ *                    page in @pages
+ * @nr:               Number of pages
+ * @gfp_flags:        The gfp flag for memory allocation
+ *
+ * Same as calling fscrypt_encrypt_page() on each whole page with its page
+ * index as block number, except that the cipher requests of all pages are
+ * issued as one batch.  Each returned bounce page must be released with
+ * fscrypt_restore_control_page().
+ *
+ * Only the bounce page of the first page is allocated with @gfp_flags, the
+ * others must not wait: none of them reaches a bio before the whole batch
+ * is encrypted, so waiting on the bounce page pool for them could deadlock.
+ * If the pool runs dry, only the pages that got a bounce page are encrypted.
+ *
+ * Return: The number of pages encrypted from the start of @pages, at least
+ * one.  On error no bounce page is left allocated.
+ */
+int fscrypt_encrypt_pages(const struct inode *inode, struct page **pages,
+			  struct page **ciphertext_pages, unsigned int nr,
+			  gfp_t gfp_flags)
+{
+	bool own_pages = inode->i_sb->s_cop->flags & FS_CFLG_OWN_PAGES;
+	struct fscrypt_page_op *ops;
+	struct fscrypt_ctx **ctxs;
+	unsigned int i, nr_ctxs = 0;
+	int err = 0;
+
+	ops = kmalloc_array(nr, sizeof(*ops) + sizeof(*ctxs), gfp_flags);
+	if (!ops)
+		return -ENOMEM;
+	ctxs = (struct fscrypt_ctx **)(ops + nr);
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+		struct page *ciphertext_page = page;
+
+		if (!own_pages) {
+			gfp_t gfp = i ? GFP_NOWAIT | __GFP_NOWARN : gfp_flags;
+			struct fscrypt_ctx *ctx;
+
+			BUG_ON(!PageLocked(page));
+			ctx = fscrypt_get_ctx(inode, gfp);
+			if (IS_ERR(ctx)) {
+				err = PTR_ERR(ctx);
+				goto partial;
+			}
+			ctxs[nr_ctxs++] = ctx;
+			ciphertext_page = fscrypt_alloc_bounce_page(ctx, gfp);
+			if (IS_ERR(ciphertext_page)) {
+				err = PTR_ERR(ciphertext_page);
+				fscrypt_release_ctx(ctxs[--nr_ctxs]);
+				goto partial;
+			}
+			ctx->w.control_page = page;
+		}
+
+		ops[i].src_page = page;
+		ops[i].dest_page = ciphertext_page;
+		ops[i].lblk_num = page->index;
+		ops[i].len = PAGE_SIZE;
+		ops[i].offs = 0;
+		ciphertext_pages[i] = ciphertext_page;
+	}
+partial:
+	/* go with the pages we got bounce pages for */
+	if (!i)
+		goto out;
+	nr = i;
+
+	err = fscrypt_crypt_pages(inode, FS_ENCRYPT, ops, nr, gfp_flags);
+	if (err || own_pages)
+		goto out;
+
+	for (i = 0; i < nr; i++) {
+		SetPagePrivate(ciphertext_pages[i]);
+		set_page_private(ciphertext_pages[i], (unsigned long)ctxs[i]);
+		lock_page(ciphertext_pages[i]);
+	}
+	nr_ctxs = 0;
+out:
+	while (nr_ctxs)
+		fscrypt_release_ctx(ctxs[--nr_ctxs]);
+	kfree(ops);
+	return err ? err : nr;
+}
+EXPORT_SYMBOL(fscrypt_encrypt_pages);
+
 /**
  * fscrypt_decrypt_page() - Decrypts a page in-place
  * @inode:     The corresponding inode for the page to decrypt.
@@ -463,9 +734,18 @@ static int __init fscrypt_init(void)
 	if (!fscrypt_read_workqueue)
 		goto fail;
 
+	/*
+	 * Read bios are preferably decrypted on the CPU that completed or
+	 * submitted them, where their pages and the reader are cache hot.
+	 */
+	fscrypt_read_percpu_workqueue = alloc_workqueue("fscrypt_read_percpu",
+							WQ_HIGHPRI, 0);
+	if (!fscrypt_read_percpu_workqueue)
+		goto fail_free_queue;
+
 	fscrypt_ctx_cachep = KMEM_CACHE(fscrypt_ctx, SLAB_RECLAIM_ACCOUNT);
 	if (!fscrypt_ctx_cachep)
-		goto fail_free_queue;
+		goto fail_free_percpu_queue;
 
 	fscrypt_info_cachep = KMEM_CACHE(fscrypt_info, SLAB_RECLAIM_ACCOUNT);
 	if (!fscrypt_info_cachep)
@@ -475,6 +755,8 @@ static int __init fscrypt_init(void)
 
 fail_free_ctx:
 	kmem_cache_destroy(fscrypt_ctx_cachep);
+fail_free_percpu_queue:
+	destroy_workqueue(fscrypt_read_percpu_workqueue);
 fail_free_queue:
 	destroy_workqueue(fscrypt_read_workqueue);
 fail:
@@ -487,10 +769,16 @@ module_init(fscrypt_init)
  */
 static void __exit fscrypt_exit(void)
 {
+	int cpu;
+
 	fscrypt_destroy();
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(fscrypt_batch_cache, cpu));
 
 	if (fscrypt_read_workqueue)
 		destroy_workqueue(fscrypt_read_workqueue);
+	if (fscrypt_read_percpu_workqueue)
+		destroy_workqueue(fscrypt_read_percpu_workqueue);
 	kmem_cache_destroy(fscrypt_ctx_cachep);
 	kmem_cache_destroy(fscrypt_info_cachep);
 
@@ -69,6 +69,19 @@ typedef enum {
 	FS_ENCRYPT,
 } fscrypt_direction_t;
 
+/*
+ * One page (or part of a page) to be encrypted or decrypted by
+ * fscrypt_crypt_pages().  @err receives the result.
+ */
+struct fscrypt_page_op {
+	struct page *src_page;
+	struct page *dest_page;
+	u64 lblk_num;
+	unsigned int len;
+	unsigned int offs;
+	int err;
+};
+
 #define FS_CTX_REQUIRES_FREE_ENCRYPT_FL		0x00000001
 #define FS_CTX_HAS_BOUNCE_BUFFER_FL		0x00000002
 
@@ -88,6 +101,9 @@ static inline bool fscrypt_valid_enc_modes(u32 contents_mode,
 
 /* crypto.c */
 extern struct kmem_cache *fscrypt_info_cachep;
+extern void fscrypt_enqueue_decrypt_work_on(int cpu, struct work_struct *work,
+					    int *work_cpu);
+extern void fscrypt_decrypt_work_done(int cpu);
 extern int fscrypt_initialize(unsigned int cop_flags);
 extern int fscrypt_do_page_crypto(const struct inode *inode,
 				  fscrypt_direction_t rw, u64 lblk_num,
@@ -95,6 +111,10 @@ extern int fscrypt_do_page_crypto(const struct inode *inode,
 				  struct page *dest_page,
 				  unsigned int len, unsigned int offs,
 				  gfp_t gfp_flags);
+extern int fscrypt_crypt_pages(const struct inode *inode,
+			       fscrypt_direction_t rw,
+			       struct fscrypt_page_op *ops, unsigned int nr,
+			       gfp_t gfp_flags);
 extern struct page *fscrypt_alloc_bounce_page(struct fscrypt_ctx *ctx,
 					      gfp_t gfp_flags);
 extern const struct dentry_operations fscrypt_d_ops;
@@ -479,6 +479,10 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 		dio->bio_cookie = BLK_QC_T_NONE;
 	} else
 		dio->bio_cookie = submit_bio(bio);
+	if (dio->is_async && (dio->iocb->ki_flags & IOCB_HIPRI)) {
+		WRITE_ONCE(dio->iocb->ki_poll_queue, dio->bio_disk->queue);
+		WRITE_ONCE(dio->iocb->ki_cookie, dio->bio_cookie);
+	}
 
 	sdio->bio = NULL;
 	sdio->boundary = 0;
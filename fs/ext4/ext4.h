@@ -223,6 +223,19 @@ struct ext4_io_submit {
 	sector_t		io_next_block;
 };
 
+/*
+ * Pages of an encrypted inode collected by writeback so that they can be
+ * encrypted together, see ext4_bio_write_pages().
+ */
+#define EXT4_IO_BATCH_PAGES	16
+
+struct ext4_page_batch {
+	unsigned int		nr;
+	struct page		*pages[EXT4_IO_BATCH_PAGES];
+	int			lens[EXT4_IO_BATCH_PAGES];
+	struct page		*data_pages[EXT4_IO_BATCH_PAGES];
+};
+
 /*
  * Special inodes numbers
  */
@@ -3145,6 +3158,8 @@ extern long ext4_fallocate(struct file *file, int mode, loff_t offset,
 			  loff_t len);
 extern int ext4_convert_unwritten_extents(handle_t *handle, struct inode *inode,
 					  loff_t offset, ssize_t len);
+extern int ext4_convert_unwritten_range(handle_t *handle, struct inode *inode,
+					loff_t offset, ssize_t len);
 extern int ext4_map_blocks(handle_t *handle, struct inode *inode,
 			   struct ext4_map_blocks *map, int flags);
 extern int ext4_ext_calc_metadata_amount(struct inode *inode,
@@ -3203,6 +3218,9 @@ extern int ext4_bio_write_page(struct ext4_io_submit *io,
 			       int len,
 			       struct writeback_control *wbc,
 			       bool keep_towrite);
+extern int ext4_bio_write_pages(struct ext4_io_submit *io,
+				struct ext4_page_batch *batch,
+				struct writeback_control *wbc);
 
 /* mmp.c */
 extern int ext4_multi_mount_protect(struct super_block *, ext4_fsblk_t);
@@ -1706,6 +1706,7 @@ struct mpage_da_data {
 	 */
 	struct ext4_map_blocks map;
 	struct ext4_io_submit io_submit;	/* IO submission data */
+	struct ext4_page_batch batch;	/* pages waiting to be encrypted */
 	unsigned int do_map:1;
 };
 
@@ -2204,6 +2205,26 @@ static int mpage_submit_page(struct mpage_da_data *mpd, struct page *page)
 		len = size & ~PAGE_MASK;
 	else
 		len = PAGE_SIZE;
+
+	/*
+	 * Pages of encrypted files are collected and encrypted as a batch.
+	 * They stay locked until the batch is flushed, which has to happen
+	 * before the bio is submitted or io_end changes.  Batched pages are
+	 * only charged to nr_to_write once written, so the batch is also
+	 * flushed once it covers the rest of a WB_SYNC_NONE budget.
+	 */
+	if (ext4_encrypted_inode(mpd->inode) && S_ISREG(mpd->inode->i_mode)) {
+		mpd->batch.pages[mpd->batch.nr] = page;
+		mpd->batch.lens[mpd->batch.nr] = len;
+		mpd->first_page++;
+		if (++mpd->batch.nr < EXT4_IO_BATCH_PAGES &&
+		    (mpd->wbc->sync_mode != WB_SYNC_NONE ||
+		     mpd->batch.nr < mpd->wbc->nr_to_write))
+			return 0;
+		return ext4_bio_write_pages(&mpd->io_submit, &mpd->batch,
+					    mpd->wbc);
+	}
+
 	err = ext4_bio_write_page(&mpd->io_submit, page, len, mpd->wbc, false);
 	if (!err)
 		mpd->wbc->nr_to_write--;
@@ -2212,6 +2233,13 @@ static int mpage_submit_page(struct mpage_da_data *mpd, struct page *page)
 	return err;
 }
 
+static int mpage_flush_batch(struct mpage_da_data *mpd)
+{
+	if (!mpd->batch.nr)
+		return 0;
+	return ext4_bio_write_pages(&mpd->io_submit, &mpd->batch, mpd->wbc);
+}
+
 #define BH_FLAGS ((1 << BH_Unwritten) | (1 << BH_Delay))
 
 /*
@@ -2702,7 +2730,7 @@ static int ext4_writepages(struct address_space *mapping,
 	handle_t *handle = NULL;
 	struct mpage_da_data mpd;
 	struct inode *inode = mapping->host;
-	int needed_blocks, rsv_blocks = 0, ret = 0;
+	int needed_blocks, rsv_blocks = 0, ret = 0, err;
 	struct ext4_sb_info *sbi = EXT4_SB(mapping->host->i_sb);
 	bool done;
 	struct blk_plug plug;
@@ -2786,6 +2814,7 @@ static int ext4_writepages(struct address_space *mapping,
 
 	mpd.inode = inode;
 	mpd.wbc = wbc;
+	mpd.batch.nr = 0;
 	ext4_io_submit_init(&mpd.io_submit, wbc);
 retry:
 	if (wbc->sync_mode == WB_SYNC_ALL || wbc->tagged_writepages)
@@ -2806,6 +2835,9 @@ static int ext4_writepages(struct address_space *mapping,
 		goto unplug;
 	}
 	ret = mpage_prepare_extent_to_map(&mpd);
+	err = mpage_flush_batch(&mpd);
+	if (!ret)
+		ret = err;
 	/* Submit prepared bio */
 	ext4_io_submit(&mpd.io_submit);
 	ext4_put_io_end_defer(mpd.io_submit.io_end);
@@ -2879,6 +2911,9 @@ static int ext4_writepages(struct address_space *mapping,
 			handle = NULL;
 			mpd.do_map = 0;
 		}
+		err = mpage_flush_batch(&mpd);
+		if (!ret)
+			ret = err;
 		/* Submit prepared bio */
 		ext4_io_submit(&mpd.io_submit);
 		/* Unlock pages we didn't use */
@@ -25,6 +25,7 @@
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/backing-dev.h>
+#include <linux/list_sort.h>
 
 #include "ext4_jbd2.h"
 #include "xattr.h"
@@ -170,6 +171,137 @@ static int ext4_end_io(ext4_io_end_t *io)
 	return ret;
 }
 
+/*
+ * Convert the merged range [@offset, @offset + @size) covered by the
+ * io_ends on @range under @handle and release them.  @err is the error
+ * to report instead if the conversion could not be attempted.
+ */
+static int ext4_end_io_range(handle_t *handle, struct inode *inode,
+			     struct list_head *range, loff_t offset,
+			     ssize_t size, int err)
+{
+	ext4_io_end_t *io, *next;
+
+	if (list_empty(range))
+		return 0;
+
+	if (!err)
+		err = ext4_convert_unwritten_range(handle, inode, offset, size);
+	if (err < 0 && !ext4_forced_shutdown(EXT4_SB(inode->i_sb))) {
+		ext4_msg(inode->i_sb, KERN_EMERG,
+			 "failed to convert unwritten extents to written "
+			 "extents -- potential data loss!  "
+			 "(inode %lu, offset %llu, size %zd, error %d)",
+			 inode->i_ino, offset, size, err);
+	}
+
+	list_for_each_entry_safe(io, next, range, list) {
+		list_del_init(&io->list);
+		ext4_clear_io_unwritten_flag(io);
+		ext4_release_io_end(io);
+	}
+	return err;
+}
+
+static int ext4_io_end_cmp(void *priv, struct list_head *a,
+			   struct list_head *b)
+{
+	ext4_io_end_t *ia = list_entry(a, ext4_io_end_t, list);
+	ext4_io_end_t *ib = list_entry(b, ext4_io_end_t, list);
+
+	return ia->offset > ib->offset;
+}
+
+/*
+ * Convert the completed io_ends on @unwritten, all of one inode.  They are
+ * sorted by offset and io_ends whose ranges touch are converted as one
+ * range.  Instead of a transaction per io_end, the handle started from the
+ * first reservation is extended by the credits of each following io_end
+ * and that io_end's own reservation is given back.  Extending never waits
+ * for the journal; if it fails the running handle is stopped and the next
+ * reservation is started instead, just like the unbatched path does.
+ */
+static int ext4_end_io_list(struct inode *inode, struct list_head *unwritten)
+{
+	handle_t *handle = NULL;
+	LIST_HEAD(range);
+	loff_t offset = 0;
+	ssize_t size = 0;
+	int err, ret = 0;
+
+	list_sort(NULL, unwritten, ext4_io_end_cmp);
+
+	while (!list_empty(unwritten)) {
+		ext4_io_end_t *io = list_first_entry(unwritten,
+						     ext4_io_end_t, list);
+		handle_t *rsv = io->handle;
+
+		BUG_ON(!(io->flag & EXT4_IO_END_UNWRITTEN));
+
+		/* Nothing reserved (no journal), convert it on its own */
+		if (!rsv) {
+			list_del_init(&io->list);
+			err = ext4_end_io(io);
+			if (unlikely(!ret && err))
+				ret = err;
+			continue;
+		}
+
+		io->handle = NULL;
+		if (handle &&
+		    !ext4_journal_extend(handle, rsv->h_buffer_credits)) {
+			ext4_journal_free_reserved(rsv);
+		} else {
+			err = ext4_end_io_range(handle, inode, &range,
+						offset, size, 0);
+			if (unlikely(!ret && err))
+				ret = err;
+			if (handle) {
+				err = ext4_journal_stop(handle);
+				if (unlikely(!ret && err))
+					ret = err;
+			}
+
+			handle = ext4_journal_start_reserved(rsv,
+						EXT4_HT_EXT_CONVERT);
+			if (IS_ERR(handle)) {
+				err = PTR_ERR(handle);
+				handle = NULL;
+				list_move_tail(&io->list, &range);
+				err = ext4_end_io_range(NULL, inode, &range,
+							io->offset, io->size,
+							err);
+				if (unlikely(!ret && err))
+					ret = err;
+				continue;
+			}
+		}
+
+		if (!list_empty(&range) && io->offset != offset + size) {
+			err = ext4_end_io_range(handle, inode, &range,
+						offset, size, 0);
+			if (unlikely(!ret && err))
+				ret = err;
+		}
+		if (list_empty(&range)) {
+			offset = io->offset;
+			size = 0;
+		}
+		size += io->size;
+		list_move_tail(&io->list, &range);
+	}
+
+	err = ext4_end_io_range(handle, inode, &range, offset, size, 0);
+	if (unlikely(!ret && err))
+		ret = err;
+	if (handle) {
+		err = ext4_journal_stop(handle);
+		if (unlikely(!ret && err))
+			ret = err;
+	}
+	return ret;
+}
+
 static void dump_completed_IO(struct inode *inode, struct list_head *head)
 {
 #ifdef	EXT4FS_DEBUG
@@ -215,27 +347,16 @@ static void ext4_add_complete_io(ext4_io_end_t *io_end)
 static int ext4_do_flush_completed_IO(struct inode *inode,
 				      struct list_head *head)
 {
-	ext4_io_end_t *io;
 	struct list_head unwritten;
 	unsigned long flags;
 	struct ext4_inode_info *ei = EXT4_I(inode);
-	int err, ret = 0;
 
 	spin_lock_irqsave(&ei->i_completed_io_lock, flags);
 	dump_completed_IO(inode, head);
 	list_replace_init(head, &unwritten);
 	spin_unlock_irqrestore(&ei->i_completed_io_lock, flags);
 
-	while (!list_empty(&unwritten)) {
-		io = list_entry(unwritten.next, ext4_io_end_t, list);
-		BUG_ON(!(io->flag & EXT4_IO_END_UNWRITTEN));
-		list_del_init(&io->list);
-
-		err = ext4_end_io(io);
-		if (unlikely(!ret && err))
-			ret = err;
-	}
-	return ret;
+	return ext4_end_io_list(inode, &unwritten);
 }
 
 /*
@@ -270,6 +391,13 @@ void ext4_put_io_end_defer(ext4_io_end_t *io_end)
 	}
 }
 
+/*
+ * The last reference to a direct I/O io_end converts its range right here:
+ * the conversion has to be done before the I/O is reported complete, and
+ * there is no reserved handle to extend.  Unlike buffered writeback, see
+ * ext4_end_io_list(), direct I/O therefore still converts once per I/O;
+ * batching it across I/Os is left for a follow-up.
+ */
 int ext4_put_io_end(ext4_io_end_t *io_end)
 {
 	int err = 0;
@@ -384,11 +512,17 @@ static int io_submit_init_bio(struct ext4_io_submit *io,
 	return 0;
 }
 
-static int io_submit_add_bh(struct ext4_io_submit *io,
-			    struct inode *inode,
-			    struct page *page,
-			    struct buffer_head *bh)
+/*
+ * Add @nr_blocks physically contiguous blocks of @page, starting with the
+ * one of @bh, to the bio.
+ */
+static int io_submit_add_blocks(struct ext4_io_submit *io,
+				struct inode *inode,
+				struct page *page,
+				struct buffer_head *bh,
+				unsigned int nr_blocks)
 {
+	unsigned int len = nr_blocks << inode->i_blkbits;
 	int ret;
 
 	if (io->io_bio && bh->b_blocknr != io->io_next_block) {
@@ -401,26 +535,35 @@ static int io_submit_add_bh(struct ext4_io_submit *io,
 			return ret;
 		io->io_bio->bi_write_hint = inode->i_write_hint;
 	}
-	ret = bio_add_page(io->io_bio, page, bh->b_size, bh_offset(bh));
-	if (ret != bh->b_size)
+	ret = bio_add_page(io->io_bio, page, len, bh_offset(bh));
+	if (ret != len)
 		goto submit_and_retry;
-	wbc_account_io(io->io_wbc, page, bh->b_size);
-	io->io_next_block++;
+	wbc_account_io(io->io_wbc, page, len);
+	io->io_next_block += nr_blocks;
 	return 0;
 }
 
-int ext4_bio_write_page(struct ext4_io_submit *io,
-			struct page *page,
-			int len,
-			struct writeback_control *wbc,
-			bool keep_towrite)
+static int io_submit_add_bh(struct ext4_io_submit *io,
+			    struct inode *inode,
+			    struct page *page,
+			    struct buffer_head *bh)
+{
+	return io_submit_add_blocks(io, inode, page, bh, 1);
+}
+
+/*
+ * Start writeback of @page and mark the buffers that are going to be
+ * written.  Returns the number of such buffers.  *@whole is set when they
+ * cover the whole page with physically contiguous blocks, so the page can
+ * go into the bio as one segment.
+ */
+static int ext4_prepare_write_page(struct ext4_io_submit *io,
+				   struct page *page, int len,
+				   bool keep_towrite, bool *whole)
 {
-	struct page *data_page = NULL;
-	struct inode *inode = page->mapping->host;
 	unsigned block_start;
 	struct buffer_head *bh, *head;
-	int ret = 0;
-	int nr_submitted = 0;
+	sector_t next_block = 0;
 	int nr_to_submit = 0;
 
 	BUG_ON(!PageLocked(page));
@@ -450,12 +593,14 @@ int ext4_bio_write_page(struct ext4_io_submit *io,
 	 * on the first buffer finishes and we are still working on submitting
 	 * the second buffer.
 	 */
+	*whole = true;
 	bh = head = page_buffers(page);
 	do {
 		block_start = bh_offset(bh);
 		if (block_start >= len) {
 			clear_buffer_dirty(bh);
 			set_buffer_uptodate(bh);
+			*whole = false;
 			continue;
 		}
 		if (!buffer_dirty(bh) || buffer_delay(bh) ||
@@ -465,6 +610,7 @@ int ext4_bio_write_page(struct ext4_io_submit *io,
 				clear_buffer_dirty(bh);
 			if (io->io_bio)
 				ext4_io_submit(io);
+			*whole = false;
 			continue;
 		}
 		if (buffer_new(bh)) {
@@ -472,10 +618,99 @@ int ext4_bio_write_page(struct ext4_io_submit *io,
 			clean_bdev_bh_alias(bh);
 		}
 		set_buffer_async_write(bh);
+		if (nr_to_submit && bh->b_blocknr != next_block)
+			*whole = false;
+		next_block = bh->b_blocknr + 1;
 		nr_to_submit++;
 	} while ((bh = bh->b_this_page) != head);
 
+	return nr_to_submit;
+}
+
+/*
+ * Add the buffers marked by ext4_prepare_write_page() to the bio, taking
+ * the data from @data_page if the page was encrypted, and unlock @page.
+ * If @ret is an error (the encryption failed), nothing is submitted and
+ * the page is redirtied.
+ */
+static int ext4_submit_write_page(struct ext4_io_submit *io,
+				  struct page *page,
+				  struct page *data_page,
+				  bool whole, int ret)
+{
+	struct inode *inode = page->mapping->host;
+	struct buffer_head *bh, *head;
+	int nr_submitted = 0;
+
 	bh = head = page_buffers(page);
+	if (ret)
+		goto out;
+
+	if (whole) {
+		/* every buffer is written, add the page in one go */
+		ret = io_submit_add_blocks(io, inode,
+					   data_page ? data_page : page, head,
+					   PAGE_SIZE >> inode->i_blkbits);
+		if (!ret) {
+			do {
+				nr_submitted++;
+				clear_buffer_dirty(bh);
+			} while ((bh = bh->b_this_page) != head);
+		}
+	} else {
+		/* Now submit buffers to write */
+		do {
+			if (!buffer_async_write(bh))
+				continue;
+			ret = io_submit_add_bh(io, inode,
+					       data_page ? data_page : page,
+					       bh);
+			if (ret) {
+				/*
+				 * We only get here on ENOMEM.  Not much else
+				 * we can do but mark the page as dirty, and
+				 * better luck next time.
+				 */
+				break;
+			}
+			nr_submitted++;
+			clear_buffer_dirty(bh);
+		} while ((bh = bh->b_this_page) != head);
+	}
+
+	/* Error stopped previous loop? Clean up buffers... */
+	if (ret) {
+	out:
+		if (data_page)
+			fscrypt_restore_control_page(data_page);
+		printk_ratelimited(KERN_ERR "%s: ret = %d\n", __func__, ret);
+		redirty_page_for_writepage(io->io_wbc, page);
+		do {
+			clear_buffer_async_write(bh);
+			bh = bh->b_this_page;
+		} while (bh != head);
+	}
+	unlock_page(page);
+	/* Nothing submitted - we have to end page writeback */
+	if (!nr_submitted)
+		end_page_writeback(page);
+	return ret;
+}
+
+int ext4_bio_write_page(struct ext4_io_submit *io,
+			struct page *page,
+			int len,
+			struct writeback_control *wbc,
+			bool keep_towrite)
+{
+	struct page *data_page = NULL;
+	struct inode *inode = page->mapping->host;
+	int nr_to_submit;
+	bool whole;
+	int ret = 0;
+
+	nr_to_submit = ext4_prepare_write_page(io, page, len, keep_towrite,
+					       &whole);
 
 	if (ext4_encrypted_inode(inode) && S_ISREG(inode->i_mode) &&
 	    nr_to_submit) {
@@ -495,43 +730,105 @@ int ext4_bio_write_page(struct ext4_io_submit *io,
 				goto retry_encrypt;
 			}
 			data_page = NULL;
-			goto out;
 		}
 	}
 
-	/* Now submit buffers to write */
-	do {
-		if (!buffer_async_write(bh))
-			continue;
-		ret = io_submit_add_bh(io, inode,
-				       data_page ? data_page : page, bh);
-		if (ret) {
-			/*
-			 * We only get here on ENOMEM.  Not much else
-			 * we can do but mark the page as dirty, and
-			 * better luck next time.
-			 */
-			break;
+	return ext4_submit_write_page(io, page, data_page, whole, ret);
+}
+
+/*
+ * Encrypt as many of @pages as the bounce page pool allows, returning the
+ * number of pages encrypted or an error.  Data integrity writeback keeps
+ * trying as ext4_bio_write_page() does.
+ */
+static int ext4_encrypt_write_pages(struct ext4_io_submit *io,
+				    struct writeback_control *wbc,
+				    struct inode *inode, struct page **pages,
+				    struct page **data_pages, unsigned int nr)
+{
+	gfp_t gfp_flags = GFP_NOFS;
+	int ret;
+
+retry_encrypt:
+	ret = fscrypt_encrypt_pages(inode, pages, data_pages, nr, gfp_flags);
+	if (ret == -ENOMEM && wbc->sync_mode == WB_SYNC_ALL) {
+		if (io->io_bio) {
+			ext4_io_submit(io);
+			congestion_wait(BLK_RW_ASYNC, HZ/50);
 		}
-		nr_submitted++;
-		clear_buffer_dirty(bh);
-	} while ((bh = bh->b_this_page) != head);
+		gfp_flags |= __GFP_NOFAIL;
+		goto retry_encrypt;
+	}
+	return ret;
+}
 
-	/* Error stopped previous loop? Clean up buffers... */
-	if (ret) {
-	out:
-		if (data_page)
-			fscrypt_restore_control_page(data_page);
-		printk_ratelimited(KERN_ERR "%s: ret = %d\n", __func__, ret);
-		redirty_page_for_writepage(wbc, page);
-		do {
-			clear_buffer_async_write(bh);
-			bh = bh->b_this_page;
-		} while (bh != head);
+/*
+ * Write out a batch of locked pages of an encrypted inode.  The pages are
+ * prepared first and then encrypted with as few fscrypt_encrypt_pages()
+ * calls as the bounce page pool allows, rather than one page at a time.
+ * Returns the first error; pages that could not be written are redirtied,
+ * and only pages that were written are charged to wbc->nr_to_write.
+ */
+int ext4_bio_write_pages(struct ext4_io_submit *io,
+			 struct ext4_page_batch *batch,
+			 struct writeback_control *wbc)
+{
+	struct page *crypt_pages[EXT4_IO_BATCH_PAGES];
+	struct inode *inode = batch->pages[0]->mapping->host;
+	unsigned long whole = 0;
+	unsigned int i, j, nr_crypt = 0, nr_ready = 0;
+	int ret = 0, crypt_ret = 0, err;
+
+	BUG_ON(batch->nr > EXT4_IO_BATCH_PAGES);
+
+	for (i = 0; i < batch->nr; i++) {
+		struct page *page = batch->pages[i];
+		bool page_whole;
+
+		if (ext4_prepare_write_page(io, page, batch->lens[i], false,
+					    &page_whole))
+			crypt_pages[nr_crypt++] = page;
+		if (page_whole)
+			__set_bit(i, &whole);
 	}
-	unlock_page(page);
-	/* Nothing submitted - we have to end page writeback */
-	if (!nr_submitted)
-		end_page_writeback(page);
+
+	for (i = 0, j = 0; i < batch->nr; i++) {
+		struct page *page = batch->pages[i];
+		struct page *data_page = NULL;
+		int crypt_err = 0;
+
+		if (j < nr_crypt && crypt_pages[j] == page) {
+			if (j == nr_ready && !crypt_ret) {
+				/*
+				 * The pool ran dry on the previous call, so
+				 * get the bounce pages we hold into flight
+				 * before waiting for another one.
+				 */
+				if (nr_ready && io->io_bio)
+					ext4_io_submit(io);
+				err = ext4_encrypt_write_pages(io, wbc, inode,
+						crypt_pages + j,
+						batch->data_pages + j,
+						nr_crypt - j);
+				if (err < 0)
+					crypt_ret = err;
+				else
+					nr_ready += err;
+			}
+			if (j < nr_ready)
+				data_page = batch->data_pages[j];
+			else
+				crypt_err = crypt_ret;
+			j++;
+		}
+		err = ext4_submit_write_page(io, page, data_page,
+					     test_bit(i, &whole), crypt_err);
+		if (!err)
+			wbc->nr_to_write--;
+		else if (!ret)
+			ret = err;
+	}
+
+	batch->nr = 0;
 	return ret;
 }
@@ -1697,6 +1697,12 @@ iomap_dio_bio_actor(struct inode *inode, loff_t pos, loff_t length,
 
 		dio->submit.last_queue = bdev_get_queue(iomap->bdev);
 		dio->submit.cookie = submit_bio(bio);
+		if (!is_sync_kiocb(dio->iocb) &&
+		    (dio->iocb->ki_flags & IOCB_HIPRI)) {
+			WRITE_ONCE(dio->iocb->ki_poll_queue,
+				   dio->submit.last_queue);
+			WRITE_ONCE(dio->iocb->ki_cookie, dio->submit.cookie);
+		}
 	} while (nr_pages);
 
 	if (need_zeroout) {
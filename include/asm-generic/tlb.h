@@ -87,6 +87,12 @@ struct mmu_gather_batch {
  */
 #define MAX_GATHER_BATCH_COUNT	(10000UL/MAX_GATHER_BATCH)
 
+/*
+ * Batches that are freed in the background rather than by the unmapping
+ * task may grow up to this limit.
+ */
+#define MAX_GATHER_BATCH_COUNT_DEFERRED	(MAX_GATHER_BATCH_COUNT * 16)
+
 /* struct mmu_gather is an opaque type used by the mm code for passing around
  * any data needed by arch specific code for tlb_remove_page.
  */
@@ -108,6 +114,7 @@ struct mmu_gather {
 	struct mmu_gather_batch	local;
 	struct page		*__pages[MMU_GATHER_BUNDLE];
 	unsigned int		batch_count;
+	unsigned int		batch_limit;
 	int page_size;
 };
 
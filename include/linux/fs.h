@@ -317,6 +317,8 @@ struct kiocb {
 	int			ki_flags;
 	u16			ki_hint;
 	u16			ki_ioprio; /* See linux/ioprio.h */
+	unsigned int		ki_cookie; /* for polled aio, see blk_poll() */
+	struct request_queue	*ki_poll_queue; /* queue ki_cookie is for */
 
 	randomized_struct_fields_end
 };
@@ -41,9 +41,11 @@ struct fscrypt_ctx {
 		struct {
 			struct bio *bio;
 			struct work_struct work;
+			int work_cpu;		/* per-CPU queue used, or -1 */
 		} r;
 		struct list_head free_list;	/* Free list */
 	};
+	int submit_cpu;				/* CPU the I/O was issued on */
 	u8 flags;				/* Flags */
 };
 
@@ -65,6 +67,8 @@ extern void fscrypt_release_ctx(struct fscrypt_ctx *);
 extern struct page *fscrypt_encrypt_page(const struct inode *, struct page *,
 						unsigned int, unsigned int,
 						u64, gfp_t);
+extern int fscrypt_encrypt_pages(const struct inode *, struct page **,
+				 struct page **, unsigned int, gfp_t);
 extern int fscrypt_decrypt_page(const struct inode *, struct page *, unsigned int,
 				unsigned int, u64);
 
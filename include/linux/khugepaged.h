@@ -15,6 +15,8 @@ extern int __khugepaged_enter(struct mm_struct *mm);
 extern void __khugepaged_exit(struct mm_struct *mm);
 extern int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 				      unsigned long vm_flags);
+extern void __khugepaged_hint(struct mm_struct *mm, unsigned long start,
+			      unsigned long end, bool madvise);
 
 #define khugepaged_enabled()					       \
 	(transparent_hugepage_flags &				       \
@@ -55,6 +57,18 @@ static inline int khugepaged_enter(struct vm_area_struct *vma,
 				return -ENOMEM;
 	return 0;
 }
+
+/*
+ * Ask for [start, end) of @vma to be collapsed soon, because a huge page
+ * fault fell back to small pages there or it was just madvised.
+ */
+static inline void khugepaged_hint(struct vm_area_struct *vma,
+				   unsigned long start, unsigned long end,
+				   bool madvise)
+{
+	if (test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags))
+		__khugepaged_hint(vma->vm_mm, start, end, madvise);
+}
 #else /* CONFIG_TRANSPARENT_HUGEPAGE */
 static inline int khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
@@ -73,6 +87,11 @@ static inline int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 {
 	return 0;
 }
+static inline void khugepaged_hint(struct vm_area_struct *vma,
+				   unsigned long start, unsigned long end,
+				   bool madvise)
+{
+}
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
 #endif /* _LINUX_KHUGEPAGED_H */
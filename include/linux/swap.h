@@ -272,6 +272,9 @@ struct swap_info_struct {
 					 */
 	struct work_struct discard_work; /* discard worker */
 	struct swap_cluster_list discard_clusters; /* discard clusters list */
+	atomic_t ra_hits;		/* cluster readahead hits on this device */
+	atomic_t ra_win;		/* last cluster readahead window */
+	unsigned long ra_prev_offset;	/* where readahead last had no hits */
 	struct plist_node avail_lists[0]; /*
 					   * entries in swap_avail_heads, one
 					   * entry per node.
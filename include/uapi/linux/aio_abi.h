@@ -54,6 +54,48 @@ enum {
 #define IOCB_FLAG_RESFD		(1 << 0)
 #define IOCB_FLAG_IOPRIO	(1 << 1)
 
+/*
+ * Flags that may be or'ed into the "nr_events" argument of io_setup().
+ *
+ * IOCTX_FLAG_IOPOLL - Reads and writes on the context are issued as
+ *                     high priority O_DIRECT I/O, and io_getevents() polls
+ *                     the device for their completion instead of sleeping.
+ *                     Other commands are rejected with EINVAL.
+ */
+#define IOCTX_FLAG_IOPOLL	(1U << 31)
+
+/*
+ * IOCTX_FLAG_SQRING - The context has a submission ring.  On entry,
+ *                     *ctxp holds the address of a struct aio_sq_ring set
+ *                     up by user space.  Entries are submitted by calling
+ *                     io_submit() with a NULL iocbpp.
+ * IOCTX_FLAG_SQPOLL - A kernel thread consumes the submission ring without
+ *                     any system call.  It goes to sleep after a second
+ *                     without new entries, setting AIO_SQ_NEED_WAKEUP;
+ *                     io_submit(ctx, 0, NULL) wakes it up again.  It
+ *                     also sleeps while entries cannot be submitted, e.g.
+ *                     on a full completion ring, until events are reaped.
+ *                     Requires CAP_SYS_ADMIN.
+ */
+#define IOCTX_FLAG_SQRING	(1U << 30)
+#define IOCTX_FLAG_SQPOLL	(1U << 29)
+
+/*
+ * Submission ring of an IOCTX_FLAG_SQRING context.  User space stores
+ * struct iocb pointers at iocbs[tail & (nr - 1)] and then advances tail;
+ * the kernel advances head as it consumes them.  An entry that cannot be
+ * submitted completes with the error in io_event.res.
+ */
+struct aio_sq_ring {
+	__u32	head;
+	__u32	tail;
+	__u32	nr;		/* number of entries, a power of two */
+	__u32	flags;		/* AIO_SQ_* */
+	__u64	iocbs[0];
+};
+
+#define AIO_SQ_NEED_WAKEUP	(1U << 0)
+
 /* read() from /dev/aio returns these structures. */
 struct io_event {
 	__u64		data;		/* the data field from the iocb */
@@ -1309,6 +1309,96 @@ static inline bool is_via_compact_memory(int order)
 	return order == -1;
 }
 
+/*
+ * Order that proactive compaction tries to keep free blocks of. That is
+ * the size of a THP or, failing that, a huge page: the allocations that
+ * would otherwise stall in direct compaction.
+ */
+#if defined CONFIG_TRANSPARENT_HUGEPAGE
+#define COMPACTION_HPAGE_ORDER	HPAGE_PMD_ORDER
+#elif defined CONFIG_HUGETLBFS
+#define COMPACTION_HPAGE_ORDER	HUGETLB_PAGE_ORDER
+#else
+#define COMPACTION_HPAGE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+#endif
+
+/*
+ * vm.compaction_proactiveness: how aggressively kcompactd keeps the
+ * fragmentation score of each node down, from 0 (proactive compaction
+ * disabled) to 100, default 20.  kcompactd starts compacting a node whose
+ * score is more than 10 points above 100 - proactiveness, and stops once
+ * it is back under 100 - proactiveness (but not under 5).
+ */
+int sysctl_compaction_proactiveness = 20;
+
+/* How often kcompactd looks at the fragmentation score while idle */
+#define HPAGE_FRAG_CHECK_INTERVAL_MSEC	500
+
+static inline bool kswapd_is_running(pg_data_t *pgdat)
+{
+	return pgdat->kswapd && (pgdat->kswapd->state == TASK_RUNNING);
+}
+
+/*
+ * The fragmentation score of a zone is the percentage of its free memory
+ * that is not in blocks of COMPACTION_HPAGE_ORDER or larger, in [0, 100].
+ */
+static unsigned int fragmentation_score_zone(struct zone *zone)
+{
+	return extfrag_for_order(zone, COMPACTION_HPAGE_ORDER);
+}
+
+/*
+ * Same, but weighted by the share of the node's memory the zone has, so
+ * that small zones like ZONE_DMA do not drive compaction of the node.
+ */
+static unsigned int fragmentation_score_zone_weighted(struct zone *zone)
+{
+	unsigned long score;
+
+	score = zone->present_pages * fragmentation_score_zone(zone);
+	return div64_ul(score, zone->zone_pgdat->node_present_pages + 1);
+}
+
+/*
+ * The fragmentation score of a node is the sum of the weighted scores of
+ * its zones, also in [0, 100]. Proactive compaction starts when it goes
+ * above the high watermark and stops when it is back under the low one.
+ */
+static unsigned int fragmentation_score_node(pg_data_t *pgdat)
+{
+	unsigned int score = 0;
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		score += fragmentation_score_zone_weighted(zone);
+	}
+
+	return score;
+}
+
+static unsigned int fragmentation_score_wmark(bool low)
+{
+	unsigned int wmark_low;
+
+	/*
+	 * Cap the low watermark to avoid excessive compaction activity in
+	 * case a user sets the proactiveness tunable close to 100.
+	 */
+	wmark_low = max(100U - sysctl_compaction_proactiveness, 5U);
+	return low ? wmark_low : min(wmark_low + 10, 100U);
+}
+
+static bool should_proactive_compact_node(pg_data_t *pgdat)
+{
+	if (!sysctl_compaction_proactiveness || kswapd_is_running(pgdat))
+		return false;
+
+	return fragmentation_score_node(pgdat) > fragmentation_score_wmark(false);
+}
+
 static enum compact_result __compact_finished(struct zone *zone,
 						struct compact_control *cc)
 {
@@ -1338,6 +1428,22 @@ static enum compact_result __compact_finished(struct zone *zone,
 			return COMPACT_PARTIAL_SKIPPED;
 	}
 
+	/*
+	 * Proactive compaction works a pageblock at a time until the zone is
+	 * back under the low watermark, and yields as soon as kswapd has to
+	 * run, so it only ever uses memory and CPU nobody else needs.
+	 */
+	if (cc->proactive_compaction) {
+		if (kswapd_is_running(zone->zone_pgdat))
+			return COMPACT_PARTIAL_SKIPPED;
+
+		if (fragmentation_score_zone_weighted(zone) >
+		    fragmentation_score_wmark(true))
+			return COMPACT_CONTINUE;
+
+		return COMPACT_SUCCESS;
+	}
+
 	if (is_via_compact_memory(cc->order))
 		return COMPACT_CONTINUE;
 
@@ -1847,6 +1953,57 @@ static void compact_node(int nid)
 	}
 }
 
+/*
+ * Compact the zones of a node whose weighted fragmentation score is above
+ * the low watermark. Called by kcompactd when the node score is above the
+ * high watermark and nothing asked it to compact for a specific order.
+ */
+static void proactive_compact_node(pg_data_t *pgdat)
+{
+	int zoneid;
+	struct zone *zone;
+	struct compact_control cc = {
+		.order = -1,
+		.mode = MIGRATE_SYNC_LIGHT,
+		.ignore_skip_hint = true,
+		.whole_zone = true,
+		.gfp_mask = GFP_KERNEL,
+		.proactive_compaction = true,
+	};
+
+	count_compact_event(KCOMPACTD_PROACTIVE_WAKE);
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (fragmentation_score_zone_weighted(zone) <=
+		    fragmentation_score_wmark(true))
+			continue;
+
+		cc.nr_freepages = 0;
+		cc.nr_migratepages = 0;
+		cc.total_migrate_scanned = 0;
+		cc.total_free_scanned = 0;
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		if (kthread_should_stop())
+			return;
+		compact_zone(zone, &cc);
+
+		count_compact_events(KCOMPACTD_MIGRATE_SCANNED,
+				     cc.total_migrate_scanned);
+		count_compact_events(KCOMPACTD_FREE_SCANNED,
+				     cc.total_free_scanned);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+}
+
 /* Compact all nodes in the system */
 static void compact_nodes(void)
 {
@@ -2056,6 +2213,7 @@ static int kcompactd(void *p)
 {
 	pg_data_t *pgdat = (pg_data_t*)p;
 	struct task_struct *tsk = current;
+	unsigned int proactive_defer = 0;
 
 	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
 
@@ -2068,11 +2226,35 @@ static int kcompactd(void *p)
 	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
 
 	while (!kthread_should_stop()) {
+		unsigned int prev_score, score;
+
 		trace_mm_compaction_kcompactd_sleep(pgdat->node_id);
-		wait_event_freezable(pgdat->kcompactd_wait,
-				kcompactd_work_requested(pgdat));
+		if (wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat),
+				msecs_to_jiffies(HPAGE_FRAG_CHECK_INTERVAL_MSEC))) {
+			kcompactd_do_work(pgdat);
+			continue;
+		}
 
-		kcompactd_do_work(pgdat);
+		/* Nothing asked for compaction, see if it is worth it anyway */
+		if (!should_proactive_compact_node(pgdat))
+			continue;
+
+		if (proactive_defer) {
+			proactive_defer--;
+			continue;
+		}
+
+		prev_score = fragmentation_score_node(pgdat);
+		proactive_compact_node(pgdat);
+		score = fragmentation_score_node(pgdat);
+		/*
+		 * Back off the way deferred compaction does if the score did
+		 * not go down, i.e. the free memory cannot be defragmented
+		 * any further right now.
+		 */
+		proactive_defer = score < prev_score ?
+					0 : 1 << COMPACT_MAX_DEFER_SHIFT;
 	}
 
 	return 0;
@@ -719,6 +719,7 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 	page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
 	if (unlikely(!page)) {
 		count_vm_event(THP_FAULT_FALLBACK);
+		khugepaged_hint(vma, haddr, haddr + HPAGE_PMD_SIZE, false);
 		return VM_FAULT_FALLBACK;
 	}
 	prep_transhuge_page(page);
@@ -25,6 +25,7 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/jhash.h>
+#include <linux/workqueue.h>
 
 #include <asm/page.h>
 #include <asm/pgtable.h>
@@ -1402,10 +1403,11 @@ static struct page *alloc_buddy_huge_page(struct hstate *h,
 }
 
 /*
- * Common helper to allocate a fresh hugetlb page. All specific allocators
- * should use this function to get new hugetlb pages
+ * Allocate a huge page and set up its compound structure, but do not account
+ * it to the hstate yet. This is the part of page creation that does not need
+ * hugetlb_lock.
  */
-static struct page *alloc_fresh_huge_page(struct hstate *h,
+static struct page *__alloc_fresh_huge_page(struct hstate *h,
 		gfp_t gfp_mask, int nid, nodemask_t *nmask)
 {
 	struct page *page;
@@ -1420,7 +1422,22 @@ static struct page *alloc_fresh_huge_page(struct hstate *h,
 
 	if (hstate_is_gigantic(h))
 		prep_compound_gigantic_page(page, huge_page_order(h));
-	prep_new_huge_page(h, page, page_to_nid(page));
+
+	return page;
+}
+
+/*
+ * Common helper to allocate a fresh hugetlb page. All specific allocators
+ * should use this function to get new hugetlb pages
+ */
+static struct page *alloc_fresh_huge_page(struct hstate *h,
+		gfp_t gfp_mask, int nid, nodemask_t *nmask)
+{
+	struct page *page;
+
+	page = __alloc_fresh_huge_page(h, gfp_mask, nid, nmask);
+	if (page)
+		prep_new_huge_page(h, page, page_to_nid(page));
 
 	return page;
 }
@@ -1449,6 +1466,143 @@ static int alloc_pool_huge_page(struct hstate *h, nodemask_t *nodes_allowed)
 	return 1;
 }
 
+/*
+ * Growing the pool is split into batches of at most HUGETLB_GROW_BATCH pages.
+ * Each batch is allocated and prepared by its own worker without holding
+ * hugetlb_lock, and is then added to the pool under a single acquisition of
+ * the lock.
+ */
+#define HUGETLB_GROW_BATCH	64
+
+struct hugetlb_grow_batch {
+	struct work_struct work;
+	struct hstate *h;
+	nodemask_t *nodes_allowed;
+	int next_nid;
+	unsigned long nr_pages;
+	struct list_head pages;
+};
+
+static void hugetlb_grow_batch_fn(struct work_struct *work)
+{
+	struct hugetlb_grow_batch *b =
+		container_of(work, struct hugetlb_grow_batch, work);
+	struct hstate *h = b->h;
+	gfp_t gfp_mask = htlb_alloc_mask(h) | __GFP_THISNODE;
+	unsigned long i;
+
+	for (i = 0; i < b->nr_pages; i++) {
+		struct page *page = NULL;
+		int nr_nodes, node;
+
+		/*
+		 * Interleave over the allowed nodes with a private cursor,
+		 * so that concurrent batches do not fight over
+		 * h->next_nid_to_alloc.
+		 */
+		for (nr_nodes = nodes_weight(*b->nodes_allowed);
+		     nr_nodes > 0; nr_nodes--) {
+			node = b->next_nid;
+			b->next_nid = next_node_allowed(node, b->nodes_allowed);
+			page = __alloc_fresh_huge_page(h, gfp_mask, node,
+						       b->nodes_allowed);
+			if (page)
+				break;
+		}
+		if (!page)
+			break;
+
+		INIT_LIST_HEAD(&page->lru);
+		set_compound_page_dtor(page, HUGETLB_PAGE_DTOR);
+		list_add_tail(&page->lru, &b->pages);
+		cond_resched();
+	}
+	b->nr_pages = i;
+}
+
+/*
+ * Account a batch of freshly allocated pages and free them into the pool.
+ * This does in one go what prep_new_huge_page() followed by put_page() does
+ * for a single page.
+ */
+static void enqueue_fresh_huge_pages(struct hstate *h, struct list_head *list)
+{
+	struct page *page, *next;
+
+	if (list_empty(list))
+		return;
+
+	spin_lock(&hugetlb_lock);
+	list_for_each_entry_safe(page, next, list, lru) {
+		int nid = page_to_nid(page);
+
+		set_hugetlb_cgroup(page, NULL);
+		h->nr_huge_pages++;
+		h->nr_huge_pages_node[nid]++;
+		set_page_count(page, 0);
+
+		if (h->surplus_huge_pages_node[nid]) {
+			/* raced with a shrink, see free_huge_page() */
+			list_del(&page->lru);
+			update_and_free_page(h, page);
+			h->surplus_huge_pages--;
+			h->surplus_huge_pages_node[nid]--;
+		} else {
+			arch_clear_hugepage_flags(page);
+			enqueue_huge_page(h, page);
+		}
+	}
+	spin_unlock(&hugetlb_lock);
+}
+
+/*
+ * Grow the pool by up to @nr pages in the node interleaved manner, returning
+ * the number of pages added. At most one batch per online CPU is run per
+ * call, so callers looping over this still get to check for signals.
+ */
+static unsigned long alloc_pool_huge_pages(struct hstate *h,
+		nodemask_t *nodes_allowed, unsigned long nr)
+{
+	struct hugetlb_grow_batch *batches;
+	unsigned long done = 0;
+	int i, nr_batches;
+
+	nr = min(nr, (unsigned long)num_online_cpus() * HUGETLB_GROW_BATCH);
+	nr_batches = DIV_ROUND_UP(nr, HUGETLB_GROW_BATCH);
+	if (!nr_batches)
+		return 0;
+
+	batches = kcalloc(nr_batches, sizeof(*batches), GFP_KERNEL);
+	if (!batches)
+		return alloc_pool_huge_page(h, nodes_allowed);
+
+	for (i = 0; i < nr_batches; i++) {
+		struct hugetlb_grow_batch *b = &batches[i];
+
+		b->h = h;
+		b->nodes_allowed = nodes_allowed;
+		b->next_nid = hstate_next_node_to_alloc(h, nodes_allowed);
+		b->nr_pages = min_t(unsigned long, HUGETLB_GROW_BATCH,
+				    nr - i * HUGETLB_GROW_BATCH);
+		INIT_LIST_HEAD(&b->pages);
+		INIT_WORK(&b->work, hugetlb_grow_batch_fn);
+		/* The last batch is run by the caller itself */
+		if (i < nr_batches - 1)
+			queue_work(system_unbound_wq, &b->work);
+	}
+	hugetlb_grow_batch_fn(&batches[nr_batches - 1].work);
+
+	for (i = 0; i < nr_batches; i++) {
+		if (i < nr_batches - 1)
+			flush_work(&batches[i].work);
+		enqueue_fresh_huge_pages(h, &batches[i].pages);
+		done += batches[i].nr_pages;
+	}
+	kfree(batches);
+
+	return done;
+}
+
 /*
  * Free huge page from pool from next node to free.
  * Attempt to keep persistent huge pages more or less
@@ -2156,12 +2310,19 @@ static void __init prep_compound_huge_page(struct page *page,
 		prep_compound_page(page, order);
 }
 
-/* Put bootmem huge pages into the standard lists after mem_map is up */
-static void __init gather_bootmem_prealloc(void)
+struct bootmem_prealloc_work {
+	struct work_struct work;
+	struct list_head pages;
+};
+
+static void __init gather_bootmem_prealloc_fn(struct work_struct *work)
 {
-	struct huge_bootmem_page *m;
+	struct bootmem_prealloc_work *w =
+		container_of(work, struct bootmem_prealloc_work, work);
+	struct huge_bootmem_page *m, *next;
 
-	list_for_each_entry(m, &huge_boot_pages, list) {
+	/* m lives in the huge page itself, so fetch next before freeing it */
+	list_for_each_entry_safe(m, next, &w->pages, list) {
 		struct page *page = virt_to_page(m);
 		struct hstate *h = m->hstate;
 
@@ -2183,17 +2344,63 @@ static void __init gather_bootmem_prealloc(void)
 	}
 }
 
+/*
+ * Put bootmem huge pages into the standard lists after mem_map is up.
+ * Preparing the struct pages of a gigantic page is the expensive part,
+ * so the pages are spread round robin over one worker per online CPU.
+ */
+static void __init gather_bootmem_prealloc(void)
+{
+	struct bootmem_prealloc_work *works, fallback;
+	struct huge_bootmem_page *m, *next;
+	int i, nr_works = num_online_cpus();
+
+	if (list_empty(&huge_boot_pages))
+		return;
+
+	works = kcalloc(nr_works, sizeof(*works), GFP_KERNEL);
+	if (!works) {
+		works = &fallback;
+		nr_works = 1;
+	}
+	for (i = 0; i < nr_works; i++) {
+		INIT_WORK(&works[i].work, gather_bootmem_prealloc_fn);
+		INIT_LIST_HEAD(&works[i].pages);
+	}
+
+	i = 0;
+	list_for_each_entry_safe(m, next, &huge_boot_pages, list) {
+		list_move_tail(&m->list, &works[i].pages);
+		i = (i + 1) % nr_works;
+	}
+
+	/* The first list is handled by the caller itself */
+	for (i = 1; i < nr_works; i++)
+		if (!list_empty(&works[i].pages))
+			queue_work(system_unbound_wq, &works[i].work);
+	gather_bootmem_prealloc_fn(&works[0].work);
+	for (i = 1; i < nr_works; i++)
+		flush_work(&works[i].work);
+
+	if (works != &fallback)
+		kfree(works);
+}
+
 static void __init hugetlb_hstate_alloc_pages(struct hstate *h)
 {
-	unsigned long i;
+	unsigned long i, nr;
 
-	for (i = 0; i < h->max_huge_pages; ++i) {
+	for (i = 0; i < h->max_huge_pages; i += nr) {
 		if (hstate_is_gigantic(h)) {
 			if (!alloc_bootmem_huge_page(h))
 				break;
-		} else if (!alloc_pool_huge_page(h,
-					 &node_states[N_MEMORY]))
-			break;
+			nr = 1;
+		} else {
+			nr = alloc_pool_huge_pages(h, &node_states[N_MEMORY],
+						   h->max_huge_pages - i);
+			if (!nr)
+				break;
+		}
 		cond_resched();
 	}
 	if (i < h->max_huge_pages) {
@@ -2324,17 +2531,19 @@ static unsigned long set_max_huge_pages(struct hstate *h, unsigned long count,
 	}
 
 	while (count > persistent_huge_pages(h)) {
+		unsigned long nr = count - persistent_huge_pages(h);
+
 		/*
 		 * If this allocation races such that we no longer need the
-		 * page, free_huge_page will handle it by freeing the page
-		 * and reducing the surplus.
+		 * page, enqueue_fresh_huge_pages will handle it by freeing
+		 * the page and reducing the surplus.
 		 */
 		spin_unlock(&hugetlb_lock);
 
 		/* yield cpu to avoid soft lockup */
 		cond_resched();
 
-		ret = alloc_pool_huge_page(h, nodes_allowed);
+		ret = alloc_pool_huge_pages(h, nodes_allowed, nr);
 		spin_lock(&hugetlb_lock);
 		if (!ret)
 			goto out;
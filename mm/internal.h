@@ -43,6 +43,15 @@ vm_fault_t do_swap_page(struct vm_fault *vmf);
 void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *start_vma,
 		unsigned long floor, unsigned long ceiling);
 
+#ifdef CONFIG_MMU
+bool tlb_free_flush(void);
+#else
+static inline bool tlb_free_flush(void)
+{
+	return false;
+}
+#endif
+
 static inline bool can_madv_dontneed_vma(struct vm_area_struct *vma)
 {
 	return !(vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP));
@@ -204,6 +213,7 @@ struct compact_control {
 	bool whole_zone;		/* Whole zone should/has been scanned */
 	bool contended;			/* Signal lock or sched contention */
 	bool finishing_block;		/* Finishing current pageblock */
+	bool proactive_compaction;	/* kcompactd proactive compaction */
 };
 
 unsigned long
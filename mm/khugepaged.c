@@ -18,6 +18,7 @@
 #include <linux/page_idle.h>
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
+#include <linux/workqueue.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -81,11 +82,17 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
  * @hash: hash collision list
  * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
  * @mm: the mm that this information is valid for
+ * @hints: collapse hints queued for this mm
+ * @nr_hints: number of entries on @hints
+ * @nr_collapsing: number of hint workers collapsing in this mm
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	struct list_head hints;
+	unsigned int nr_hints;
+	unsigned int nr_collapsing;
 };
 
 /**
@@ -106,6 +113,44 @@ static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
 };
 
+/*
+ * Collapse hints are PMD ranges that a page fault failed to get a huge
+ * page for, or that were just madvised MADV_HUGEPAGE. Rather than waiting
+ * for the khugepaged scan to come around to them, they are queued by
+ * priority and collapsed by a few workers right away. A range that is
+ * hinted again while still queued moves up one priority.
+ */
+#define KHUGEPAGED_HINT_PRIOS		4
+#define KHUGEPAGED_MAX_HINTS		1024
+#define KHUGEPAGED_MAX_MM_HINTS		64
+#define KHUGEPAGED_MAX_HINT_WORKERS	8
+
+/**
+ * struct khugepaged_hint - a range worth collapsing soon
+ * @prio_node: link into khugepaged_hint_queue[@prio]
+ * @mm_node: link into the hints of @mm_slot
+ * @mm_slot: the mm_slot of the mm the range is in
+ * @start: PMD aligned start of the range
+ * @end: PMD aligned end of the range
+ * @prio: priority, higher is collapsed first
+ */
+struct khugepaged_hint {
+	struct list_head prio_node;
+	struct list_head mm_node;
+	struct mm_slot *mm_slot;
+	unsigned long start;
+	unsigned long end;
+	unsigned int prio;
+};
+
+/* hints are protected by khugepaged_mm_lock */
+static struct list_head khugepaged_hint_queue[KHUGEPAGED_HINT_PRIOS];
+static unsigned int khugepaged_nr_hints;
+static unsigned int khugepaged_hint_workers __read_mostly = 2;
+static struct kmem_cache *hint_cache __read_mostly;
+static struct workqueue_struct *khugepaged_hint_wq __read_mostly;
+static struct work_struct khugepaged_hint_work[KHUGEPAGED_MAX_HINT_WORKERS];
+
 #ifdef CONFIG_SYSFS
 static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
 					 struct kobj_attribute *attr,
@@ -283,6 +328,53 @@ static struct kobj_attribute khugepaged_max_ptes_swap_attr =
 	__ATTR(max_ptes_swap, 0644, khugepaged_max_ptes_swap_show,
 	       khugepaged_max_ptes_swap_store);
 
+/*
+ * hint_workers is the number of workers collapsing hinted ranges in
+ * parallel with the khugepaged scan. 0 ignores hints altogether.
+ */
+static ssize_t hint_workers_show(struct kobject *kobj,
+				 struct kobj_attribute *attr,
+				 char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_hint_workers);
+}
+
+static ssize_t hint_workers_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct khugepaged_hint *hint, *next;
+	unsigned long workers;
+	int err, prio;
+
+	err = kstrtoul(buf, 10, &workers);
+	if (err || workers > KHUGEPAGED_MAX_HINT_WORKERS)
+		return -EINVAL;
+
+	WRITE_ONCE(khugepaged_hint_workers, workers);
+	if (workers)
+		return count;
+
+	/* nobody would take the queued hints off again */
+	spin_lock(&khugepaged_mm_lock);
+	for (prio = 0; prio < KHUGEPAGED_HINT_PRIOS; prio++) {
+		list_for_each_entry_safe(hint, next,
+					 &khugepaged_hint_queue[prio],
+					 prio_node) {
+			list_del(&hint->prio_node);
+			list_del(&hint->mm_node);
+			hint->mm_slot->nr_hints--;
+			khugepaged_nr_hints--;
+			kmem_cache_free(hint_cache, hint);
+		}
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	return count;
+}
+static struct kobj_attribute hint_workers_attr =
+	__ATTR(hint_workers, 0644, hint_workers_show, hint_workers_store);
+
 static struct attribute *khugepaged_attr[] = {
 	&khugepaged_defrag_attr.attr,
 	&khugepaged_max_ptes_none_attr.attr,
@@ -292,6 +384,7 @@ static struct attribute *khugepaged_attr[] = {
 	&scan_sleep_millisecs_attr.attr,
 	&alloc_sleep_millisecs_attr.attr,
 	&khugepaged_max_ptes_swap_attr.attr,
+	&hint_workers_attr.attr,
 	NULL,
 };
 
@@ -342,23 +435,52 @@ int hugepage_madvise(struct vm_area_struct *vma,
 	return 0;
 }
 
+static void khugepaged_hint_worker(struct work_struct *work);
+
 int __init khugepaged_init(void)
 {
+	int i;
+
 	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
 					  sizeof(struct mm_slot),
 					  __alignof__(struct mm_slot), 0, NULL);
 	if (!mm_slot_cache)
 		return -ENOMEM;
 
+	hint_cache = KMEM_CACHE(khugepaged_hint, 0);
+	if (!hint_cache)
+		goto out_free_mm_slot_cache;
+
+	khugepaged_hint_wq = alloc_workqueue("khugepaged_hint",
+					     WQ_UNBOUND | WQ_FREEZABLE,
+					     KHUGEPAGED_MAX_HINT_WORKERS);
+	if (!khugepaged_hint_wq)
+		goto out_free_hint_cache;
+
+	for (i = 0; i < KHUGEPAGED_HINT_PRIOS; i++)
+		INIT_LIST_HEAD(&khugepaged_hint_queue[i]);
+	for (i = 0; i < KHUGEPAGED_MAX_HINT_WORKERS; i++)
+		INIT_WORK(&khugepaged_hint_work[i], khugepaged_hint_worker);
+
 	khugepaged_pages_to_scan = HPAGE_PMD_NR * 8;
 	khugepaged_max_ptes_none = HPAGE_PMD_NR - 1;
 	khugepaged_max_ptes_swap = HPAGE_PMD_NR / 8;
 
 	return 0;
+
+out_free_hint_cache:
+	kmem_cache_destroy(hint_cache);
+	hint_cache = NULL;
+out_free_mm_slot_cache:
+	kmem_cache_destroy(mm_slot_cache);
+	mm_slot_cache = NULL;
+	return -ENOMEM;
 }
 
 void __init khugepaged_destroy(void)
 {
+	destroy_workqueue(khugepaged_hint_wq);
+	kmem_cache_destroy(hint_cache);
 	kmem_cache_destroy(mm_slot_cache);
 }
 
@@ -392,6 +514,21 @@ static void insert_to_mm_slots_hash(struct mm_struct *mm,
 	hash_add(mm_slots_hash, &mm_slot->hash, (long)mm);
 }
 
+static void free_mm_slot_hints(struct mm_slot *mm_slot)
+{
+	struct khugepaged_hint *hint, *next;
+
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+
+	list_for_each_entry_safe(hint, next, &mm_slot->hints, mm_node) {
+		list_del(&hint->prio_node);
+		list_del(&hint->mm_node);
+		kmem_cache_free(hint_cache, hint);
+		khugepaged_nr_hints--;
+	}
+	mm_slot->nr_hints = 0;
+}
+
 static inline int khugepaged_test_exit(struct mm_struct *mm)
 {
 	return atomic_read(&mm->mm_users) == 0;
@@ -433,6 +570,8 @@ int __khugepaged_enter(struct mm_struct *mm)
 		return 0;
 	}
 
+	INIT_LIST_HEAD(&mm_slot->hints);
+
 	spin_lock(&khugepaged_mm_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
@@ -476,7 +615,10 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot)
+		free_mm_slot_hints(mm_slot);
+	if (mm_slot && khugepaged_scan.mm_slot != mm_slot &&
+	    !mm_slot->nr_collapsing) {
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
 		free = 1;
@@ -494,7 +636,7 @@ void __khugepaged_exit(struct mm_struct *mm)
 		 * under mmap sem read mode). Stop here (after we
 		 * return all pagetables will be destroyed) until
 		 * khugepaged has finished working on the pagetables
-		 * under the mmap_sem.
+		 * under the mmap_sem. The same goes for the hint workers.
 		 */
 		down_write(&mm->mmap_sem);
 		up_write(&mm->mmap_sem);
@@ -631,52 +773,72 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 	return 0;
 }
 
+/*
+ * Subpages are copied in batches of COLLAPSE_COPY_BATCH, so that the page
+ * table lock is taken and the source pages are freed once per batch rather
+ * than once per subpage.
+ */
+#define COLLAPSE_COPY_BATCH 16
+
 static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 				      struct vm_area_struct *vma,
 				      unsigned long address,
 				      spinlock_t *ptl)
 {
-	pte_t *_pte;
-	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
-				_pte++, page++, address += PAGE_SIZE) {
-		pte_t pteval = *_pte;
-		struct page *src_page;
-
-		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
-			clear_user_highpage(page, address);
-			add_mm_counter(vma->vm_mm, MM_ANONPAGES, 1);
-			if (is_zero_pfn(pte_pfn(pteval))) {
-				/*
-				 * ptl mostly unnecessary.
-				 */
-				spin_lock(ptl);
-				/*
-				 * paravirt calls inside pte_clear here are
-				 * superfluous.
-				 */
-				pte_clear(vma->vm_mm, address, _pte);
-				spin_unlock(ptl);
+	struct page *src_pages[COLLAPSE_COPY_BATCH];
+	int i, nr_src;
+
+	for (i = 0; i < HPAGE_PMD_NR; i += COLLAPSE_COPY_BATCH) {
+		pte_t *batch_pte = pte + i;
+		unsigned long batch_address = address + i * PAGE_SIZE;
+		pte_t *_pte;
+		unsigned long _address;
+
+		nr_src = 0;
+		for (_pte = batch_pte, _address = batch_address;
+		     _pte < batch_pte + COLLAPSE_COPY_BATCH;
+		     _pte++, page++, _address += PAGE_SIZE) {
+			pte_t pteval = *_pte;
+			struct page *src_page;
+
+			if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
+				clear_user_highpage(page, _address);
+				add_mm_counter(vma->vm_mm, MM_ANONPAGES, 1);
+			} else {
+				src_page = pte_page(pteval);
+				copy_user_highpage(page, src_page, _address,
+						   vma);
+				VM_BUG_ON_PAGE(page_mapcount(src_page) != 1,
+					       src_page);
+				release_pte_page(src_page);
+				src_pages[nr_src++] = src_page;
 			}
-		} else {
-			src_page = pte_page(pteval);
-			copy_user_highpage(page, src_page, address, vma);
-			VM_BUG_ON_PAGE(page_mapcount(src_page) != 1, src_page);
-			release_pte_page(src_page);
-			/*
-			 * ptl mostly unnecessary, but preempt has to
-			 * be disabled to update the per-cpu stats
-			 * inside page_remove_rmap().
-			 */
-			spin_lock(ptl);
+		}
+
+		/*
+		 * ptl mostly unnecessary, but preempt has to be disabled
+		 * to update the per-cpu stats inside page_remove_rmap().
+		 */
+		spin_lock(ptl);
+		for (_pte = batch_pte, _address = batch_address;
+		     _pte < batch_pte + COLLAPSE_COPY_BATCH;
+		     _pte++, _address += PAGE_SIZE) {
+			pte_t pteval = *_pte;
+
+			if (pte_none(pteval))
+				continue;
 			/*
 			 * paravirt calls inside pte_clear here are
 			 * superfluous.
 			 */
-			pte_clear(vma->vm_mm, address, _pte);
-			page_remove_rmap(src_page, false);
-			spin_unlock(ptl);
-			free_page_and_swap_cache(src_page);
+			pte_clear(vma->vm_mm, _address, _pte);
+			if (!is_zero_pfn(pte_pfn(pteval)))
+				page_remove_rmap(pte_page(pteval), false);
 		}
+		spin_unlock(ptl);
+
+		if (nr_src)
+			free_pages_and_swap_cache(src_pages, nr_src);
 	}
 }
 
@@ -690,9 +852,19 @@ static void khugepaged_alloc_sleep(void)
 	remove_wait_queue(&khugepaged_wait, &wait);
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
+/**
+ * struct collapse_control - per-collapser scan state
+ * @node_load: pages of the last scanned range found on each node
+ *
+ * khugepaged and each of the hint workers scan with their own instance.
+ */
+struct collapse_control {
+	int node_load[MAX_NUMNODES];
+};
+
+static struct collapse_control khugepaged_collapse_control;
 
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(int nid, struct collapse_control *cc)
 {
 	int i;
 
@@ -704,11 +876,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (cc->node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!cc->node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -723,15 +895,15 @@ static inline gfp_t alloc_hugepage_khugepaged_gfpmask(void)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (cc->node_load[nid] > max_value) {
+			max_value = cc->node_load[nid];
 			target_node = nid;
 		}
 
@@ -739,7 +911,7 @@ static int khugepaged_find_target_node(void)
 	if (target_node <= last_khugepaged_target_node)
 		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == cc->node_load[nid]) {
 				target_node = nid;
 				break;
 			}
@@ -782,7 +954,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct collapse_control *cc)
 {
 	return 0;
 }
@@ -1102,7 +1274,8 @@ static void collapse_huge_page(struct mm_struct *mm,
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
-			       struct page **hpage)
+			       struct page **hpage,
+			       struct collapse_control *cc)
 {
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
@@ -1121,7 +1294,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 	}
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -1164,16 +1337,16 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to cc->node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			goto out_unmap;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			goto out_unmap;
@@ -1214,7 +1387,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(cc);
 		/* collapse_huge_page will return with the mmap_sem released */
 		collapse_huge_page(mm, address, hpage, node, referenced);
 	}
@@ -1230,8 +1403,9 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 
 	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
 
-	if (khugepaged_test_exit(mm)) {
+	if (khugepaged_test_exit(mm) && !mm_slot->nr_collapsing) {
 		/* free mm_slot */
+		free_mm_slot_hints(mm_slot);
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
 
@@ -1586,7 +1760,8 @@ static void collapse_shmem(struct mm_struct *mm,
 
 static void khugepaged_scan_shmem(struct mm_struct *mm,
 		struct address_space *mapping,
-		pgoff_t start, struct page **hpage)
+		pgoff_t start, struct page **hpage,
+		struct collapse_control *cc)
 {
 	struct page *page = NULL;
 	struct radix_tree_iter iter;
@@ -1597,7 +1772,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 
 	present = 0;
 	swap = 0;
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(cc->node_load, 0, sizeof(cc->node_load));
 	rcu_read_lock();
 	radix_tree_for_each_slot(slot, &mapping->i_pages, &iter, start) {
 		if (iter.index >= start + HPAGE_PMD_NR)
@@ -1623,11 +1798,11 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		}
 
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node)) {
+		if (khugepaged_scan_abort(node, cc)) {
 			result = SCAN_SCAN_ABORT;
 			break;
 		}
-		khugepaged_node_load[node]++;
+		cc->node_load[node]++;
 
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
@@ -1658,7 +1833,7 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
-			node = khugepaged_find_target_node();
+			node = khugepaged_find_target_node(cc);
 			collapse_shmem(mm, mapping, start, hpage, node);
 		}
 	}
@@ -1668,7 +1843,8 @@ static void khugepaged_scan_shmem(struct mm_struct *mm,
 #else
 static void khugepaged_scan_shmem(struct mm_struct *mm,
 		struct address_space *mapping,
-		pgoff_t start, struct page **hpage)
+		pgoff_t start, struct page **hpage,
+		struct collapse_control *cc)
 {
 	BUILD_BUG();
 }
@@ -1751,12 +1927,14 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 				up_read(&mm->mmap_sem);
 				ret = 1;
 				khugepaged_scan_shmem(mm, file->f_mapping,
-						pgoff, hpage);
+						pgoff, hpage,
+						&khugepaged_collapse_control);
 				fput(file);
 			} else {
 				ret = khugepaged_scan_pmd(mm, vma,
 						khugepaged_scan.address,
-						hpage);
+						hpage,
+						&khugepaged_collapse_control);
 			}
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
@@ -1800,6 +1978,174 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	return progress;
 }
 
+void __khugepaged_hint(struct mm_struct *mm, unsigned long start,
+		       unsigned long end, bool madvise)
+{
+	struct khugepaged_hint *hint, *new;
+	struct mm_slot *mm_slot;
+	unsigned int workers = READ_ONCE(khugepaged_hint_workers);
+	bool queued = false;
+	int i;
+
+	start = (start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	end &= HPAGE_PMD_MASK;
+	if (!workers || !hint_cache || start >= end ||
+	    !khugepaged_enabled())
+		return;
+
+	new = kmem_cache_alloc(hint_cache, GFP_NOWAIT | __GFP_NOWARN);
+	if (!new)
+		return;
+
+	spin_lock(&khugepaged_mm_lock);
+	/* hint_workers may have been set to 0 and the queues flushed */
+	if (!READ_ONCE(khugepaged_hint_workers))
+		goto out_unlock;
+	mm_slot = get_mm_slot(mm);
+	if (!mm_slot)
+		goto out_unlock;
+
+	list_for_each_entry(hint, &mm_slot->hints, mm_node) {
+		if (start < hint->start || end > hint->end)
+			continue;
+		/* already queued, asked for again: move it up */
+		if (hint->prio < KHUGEPAGED_HINT_PRIOS - 1)
+			hint->prio++;
+		list_move_tail(&hint->prio_node,
+			       &khugepaged_hint_queue[hint->prio]);
+		goto out_unlock;
+	}
+
+	if (mm_slot->nr_hints >= KHUGEPAGED_MAX_MM_HINTS ||
+	    khugepaged_nr_hints >= KHUGEPAGED_MAX_HINTS)
+		goto out_unlock;
+
+	new->mm_slot = mm_slot;
+	new->start = start;
+	new->end = end;
+	new->prio = madvise ? 1 : 0;
+	list_add_tail(&new->mm_node, &mm_slot->hints);
+	list_add_tail(&new->prio_node, &khugepaged_hint_queue[new->prio]);
+	mm_slot->nr_hints++;
+	khugepaged_nr_hints++;
+	new = NULL;
+	queued = true;
+out_unlock:
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (new)
+		kmem_cache_free(hint_cache, new);
+	if (queued)
+		for (i = 0; i < workers; i++)
+			queue_work(khugepaged_hint_wq,
+				   &khugepaged_hint_work[i]);
+}
+
+/*
+ * Take the highest priority hint off the queue and pin its mm_slot, so
+ * that __khugepaged_exit() waits for us as it does for the khugepaged scan.
+ */
+static bool khugepaged_next_hint(struct mm_slot **mm_slotp,
+				 unsigned long *start, unsigned long *end)
+{
+	struct khugepaged_hint *hint = NULL;
+	int prio;
+
+	spin_lock(&khugepaged_mm_lock);
+	for (prio = KHUGEPAGED_HINT_PRIOS - 1; prio >= 0; prio--) {
+		hint = list_first_entry_or_null(&khugepaged_hint_queue[prio],
+						struct khugepaged_hint,
+						prio_node);
+		if (hint)
+			break;
+	}
+	if (hint) {
+		list_del(&hint->prio_node);
+		list_del(&hint->mm_node);
+		hint->mm_slot->nr_hints--;
+		hint->mm_slot->nr_collapsing++;
+		khugepaged_nr_hints--;
+		*mm_slotp = hint->mm_slot;
+		*start = hint->start;
+		*end = hint->end;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (!hint)
+		return false;
+	kmem_cache_free(hint_cache, hint);
+	return true;
+}
+
+static void khugepaged_put_hint_mm_slot(struct mm_slot *mm_slot)
+{
+	spin_lock(&khugepaged_mm_lock);
+	if (!--mm_slot->nr_collapsing && khugepaged_scan.mm_slot != mm_slot)
+		collect_mm_slot(mm_slot);
+	spin_unlock(&khugepaged_mm_lock);
+}
+
+/*
+ * Collapse the anonymous PMDs of [start, end) that khugepaged_scan_pmd()
+ * finds worth it. Returns false if no huge page could be allocated, in
+ * which case the remaining hints are left to the khugepaged scan.
+ */
+static bool khugepaged_collapse_range(struct mm_struct *mm,
+				      unsigned long start, unsigned long end,
+				      struct page **hpage,
+				      struct collapse_control *cc)
+{
+	struct vm_area_struct *vma;
+	unsigned long address;
+	bool wait = false;
+	int result;
+
+	for (address = start; address < end; address += HPAGE_PMD_SIZE) {
+		if (!khugepaged_prealloc_page(hpage, &wait))
+			return false;
+
+		cond_resched();
+		down_read(&mm->mmap_sem);
+		result = hugepage_vma_revalidate(mm, address, &vma);
+		if (result == SCAN_ANY_PROCESS) {
+			up_read(&mm->mmap_sem);
+			break;
+		}
+		if (result || shmem_file(vma->vm_file)) {
+			up_read(&mm->mmap_sem);
+			continue;
+		}
+		/* a collapse returns with the mmap_sem released */
+		if (!khugepaged_scan_pmd(mm, vma, address, hpage, cc))
+			up_read(&mm->mmap_sem);
+	}
+	return true;
+}
+
+static void khugepaged_hint_worker(struct work_struct *work)
+{
+	struct collapse_control *cc;
+	struct mm_slot *mm_slot;
+	struct page *hpage = NULL;
+	unsigned long start, end;
+	bool more = true;
+
+	cc = kmalloc(sizeof(*cc), GFP_KERNEL);
+	if (!cc)
+		return;
+
+	while (more && khugepaged_enabled() &&
+	       khugepaged_next_hint(&mm_slot, &start, &end)) {
+		more = khugepaged_collapse_range(mm_slot->mm, start, end,
+						 &hpage, cc);
+		khugepaged_put_hint_mm_slot(mm_slot);
+	}
+
+	if (!IS_ERR_OR_NULL(hpage))
+		put_page(hpage);
+	kfree(cc);
+}
+
 static int khugepaged_has_work(void)
 {
 	return !list_empty(&khugepaged_scan.mm_head) &&
@@ -26,6 +26,9 @@
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
 #include <linux/jhash.h>
+#include <linux/xxhash.h>
+#include <linux/crc32c.h>
+#include <linux/hash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -114,15 +117,17 @@
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list, rooted in its ksm_scan's mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scan: the scanner this mm is assigned to
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	struct ksm_scan *scan;
 };
 
 /**
@@ -130,15 +135,30 @@ struct mm_slot {
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @mm_head: head of the mm_slots list scanned by this cursor
+ * @nr_mm_slots: number of mm_slots on that list
+ * @stale: rmap_items dropped under mmap_sem, not yet removed from the trees
+ * @pass: value of ksm_seqnr when this cursor last started a full scan
+ * @id: index of this cursor in ksm_scans[]
+ * @nr_merged: pages merged since the scan rate was last adjusted
+ * @nr_volatile: pages found volatile since the scan rate was last adjusted
+ * @sleep_shift: log2 of the adaptive scaling of sleep_millisecs
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is one ksm_scan instance of this cursor structure per ksmd thread,
+ * each scanning its own share of the mm_slots.
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
-	unsigned long seqnr;
+	struct mm_slot mm_head;
+	unsigned int nr_mm_slots;
+	struct rmap_item *stale;
+	unsigned long pass;
+	int id;
+	unsigned int nr_merged;
+	unsigned int nr_volatile;
+	int sleep_shift;
 };
 
 /**
@@ -189,6 +209,7 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldsample: previous sampled digest of the page at that virtual address
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -204,6 +225,7 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned int oldsample;		/* when unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -216,7 +238,8 @@ struct rmap_item {
 #define SEQNR_MASK	0x0ff	/* low bits of unstable tree seqnr */
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
-#define KSM_FLAG_MASK	(SEQNR_MASK|UNSTABLE_FLAG|STABLE_FLAG)
+#define VOLATILE_FLAG	0x400	/* changed since the previous scan */
+#define KSM_FLAG_MASK	(SEQNR_MASK|UNSTABLE_FLAG|STABLE_FLAG|VOLATILE_FLAG)
 				/* to mask all the flags */
 
 /* The stable and unstable tree heads */
@@ -232,12 +255,15 @@ static LIST_HEAD(migrate_nodes);
 #define MM_SLOTS_HASH_BITS 10
 static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+#define KSM_MAX_SCANNERS	8
+static struct ksm_scan ksm_scans[KSM_MAX_SCANNERS];
+static unsigned int ksm_nr_scanners __read_mostly;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
+
+/* Scanners which must finish their part before the full scan completes */
+static unsigned long ksm_pass_pending;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
@@ -253,7 +279,7 @@ static unsigned long ksm_pages_sharing;
 static unsigned long ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items;
 
 /* The number of stable_node chains */
 static unsigned long ksm_stable_node_chains;
@@ -273,12 +299,50 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Digests available to calc_checksum() */
+enum ksm_checksum_algo {
+	KSM_CHECKSUM_JHASH,
+	KSM_CHECKSUM_XXHASH,
+#if IS_BUILTIN(CONFIG_LIBCRC32C)
+	KSM_CHECKSUM_CRC32C,
+#endif
+	KSM_CHECKSUM_NR,
+};
+
+static const char * const ksm_checksum_names[KSM_CHECKSUM_NR] = {
+	[KSM_CHECKSUM_JHASH]	= "jhash",
+	[KSM_CHECKSUM_XXHASH]	= "xxhash",
+#if IS_BUILTIN(CONFIG_LIBCRC32C)
+	[KSM_CHECKSUM_CRC32C]	= "crc32c",
+#endif
+};
+
+/* Digest used for page checksums, changed under ksm_thread_sem */
+static unsigned int ksm_checksum_algo = KSM_CHECKSUM_XXHASH;
+
 /* Checksum of an empty (zeroed) page */
 static unsigned int zero_checksum __read_mostly;
 
 /* Whether to merge empty (zeroed) pages with actual zero pages */
 static bool ksm_use_zero_pages __read_mostly;
 
+/* Whether ksmd threads adapt their sleep to how much they manage to merge */
+static bool ksm_adaptive_scan __read_mostly = true;
+
+/*
+ * Number of ksmd threads to start, from the ksm_threads= boot parameter:
+ * 1 to KSM_MAX_SCANNERS, or 0 (default) for one per 8 online cpus.
+ */
+static unsigned int ksm_threads_param __initdata;
+
+static int __init setup_ksm_threads(char *str)
+{
+	if (kstrtouint(str, 0, &ksm_threads_param))
+		return 0;
+	return 1;
+}
+__setup("ksm_threads=", setup_ksm_threads);
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -293,10 +357,10 @@ static int ksm_nr_node_ids = 1;
 #define KSM_RUN_UNMERGE	2
 #define KSM_RUN_OFFLINE	4
 static unsigned long ksm_run = KSM_RUN_STOP;
-static void wait_while_offlining(void);
 
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+static DECLARE_RWSEM(ksm_thread_sem);
+static DEFINE_MUTEX(ksm_tree_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -381,13 +445,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL |
 						__GFP_NORETRY | __GFP_NOWARN);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -789,7 +853,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
 			rb_erase(&rmap_item->node,
@@ -801,17 +865,6 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 	cond_resched();		/* we're called from many long loops */
 }
 
-static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
-				       struct rmap_item **rmap_list)
-{
-	while (*rmap_list) {
-		struct rmap_item *rmap_item = *rmap_list;
-		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
-	}
-}
-
 /*
  * Though it's very tempting to unmerge rmap_items from stable tree rather
  * than check every pte of a given vma, the locking doesn't quite work for
@@ -854,6 +907,17 @@ static inline void set_page_stable_node(struct page *page,
 }
 
 #ifdef CONFIG_SYSFS
+static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
+				       struct rmap_item **rmap_list)
+{
+	while (*rmap_list) {
+		struct rmap_item *rmap_item = *rmap_list;
+		*rmap_list = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+}
+
 /*
  * Only called through the sysfs control interface:
  */
@@ -946,7 +1010,7 @@ static int remove_all_stable_nodes(void)
 	return err;
 }
 
-static int unmerge_and_remove_all_rmap_items(void)
+static int unmerge_and_remove_scan_rmap_items(struct ksm_scan *scan)
 {
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
@@ -954,12 +1018,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	scan->mm_slot = list_entry(scan->mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = scan->mm_slot;
+			mm_slot != &scan->mm_head; mm_slot = scan->mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -977,11 +1041,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 		up_read(&mm->mmap_sem);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		scan->mm_slot = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			scan->nr_mm_slots--;
 			spin_unlock(&ksm_mmlist_lock);
 
 			free_mm_slot(mm_slot);
@@ -990,18 +1055,39 @@ static int unmerge_and_remove_all_rmap_items(void)
 		} else
 			spin_unlock(&ksm_mmlist_lock);
 	}
-
-	/* Clean up stable nodes, but don't worry if some are still busy */
-	remove_all_stable_nodes();
-	ksm_scan.seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
+	return err;
+}
+
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	int i, err = 0;
+
+	for (i = 0; i < ksm_nr_scanners && !err; i++)
+		err = unmerge_and_remove_scan_rmap_items(&ksm_scans[i]);
+
+	/*
+	 * Whether or not that completed, every scanner starts over from the
+	 * head of its list: the unstable tree is then rebuilt by a new full
+	 * scan in which they all take part.
+	 */
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	for (i = 0; i < ksm_nr_scanners; i++) {
+		ksm_scans[i].mm_slot = &ksm_scans[i].mm_head;
+		ksm_scans[i].pass = ULONG_MAX;
+	}
 	spin_unlock(&ksm_mmlist_lock);
-	return err;
+	ksm_pass_pending = 0;
+	if (err)
+		return err;
+
+	/* Clean up stable nodes, but don't worry if some are still busy */
+	remove_all_stable_nodes();
+	ksm_seqnr = 0;
+	return 0;
 }
 #endif /* CONFIG_SYSFS */
 
@@ -1009,11 +1095,53 @@ static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+
+	switch (ksm_checksum_algo) {
+	case KSM_CHECKSUM_XXHASH:
+#if BITS_PER_LONG == 64
+		checksum = xxh64(addr, PAGE_SIZE, 0);
+#else
+		checksum = xxh32(addr, PAGE_SIZE, 0);
+#endif
+		break;
+#if IS_BUILTIN(CONFIG_LIBCRC32C)
+	case KSM_CHECKSUM_CRC32C:
+		checksum = crc32c(~0, addr, PAGE_SIZE);
+		break;
+#endif
+	default:
+		checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+		break;
+	}
 	kunmap_atomic(addr);
 	return checksum;
 }
 
+/*
+ * Number of words looked at by calc_sample(). They are spread over the
+ * whole page, each at a different offset within its cache line.
+ */
+#define KSM_SAMPLE_WORDS	16
+#define KSM_SAMPLE_STRIDE	(PAGE_SIZE / sizeof(u64) / KSM_SAMPLE_WORDS)
+
+/*
+ * Cheap digest of a few words of the page: if it differs from the previous
+ * scan, the page has certainly changed and the full checksum can be skipped.
+ */
+static u32 calc_sample(struct page *page)
+{
+	const u64 *addr = kmap_atomic(page);
+	u64 sample = 0;
+	int i;
+
+	for (i = 0; i < KSM_SAMPLE_WORDS; i++)
+		sample = (sample ^ addr[i * KSM_SAMPLE_STRIDE +
+					i % KSM_SAMPLE_STRIDE]) *
+			 GOLDEN_RATIO_64;
+	kunmap_atomic((void *)addr);
+	return sample >> 32;
+}
+
 static int memcmp_pages(struct page *page1, struct page *page2)
 {
 	char *addr1, *addr2;
@@ -1974,7 +2102,7 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
 	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
 	rb_insert_color(&rmap_item->node, root);
@@ -2026,20 +2154,26 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  * be inserted into the unstable tree, or merged with a page already there and
  * both transferred to the stable tree.
  *
+ * The trees are only looked at under ksm_tree_mutex, which is dropped while
+ * the page is checksummed, so that the scanners mostly run in parallel.
+ *
+ * @scan: the cursor of the scanner that found the page.
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct ksm_scan *scan, struct page *page,
+			       struct rmap_item *rmap_item)
 {
 	struct mm_struct *mm = rmap_item->mm;
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
+	unsigned int checksum, sample;
 	int err;
 	bool max_page_sharing_bypass = false;
 
+	mutex_lock(&ksm_tree_mutex);
 	stable_node = page_stable_node(page);
 	if (stable_node) {
 		if (stable_node->head != &migrate_nodes &&
@@ -2051,7 +2185,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		}
 		if (stable_node->head != &migrate_nodes &&
 		    rmap_item->head == stable_node)
-			return;
+			goto out_unlock;
 		/*
 		 * If it's a KSM fork, allow it to go over the sharing limit
 		 * without warnings.
@@ -2064,7 +2198,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	kpage = stable_tree_search(page);
 	if (kpage == page && rmap_item->head == stable_node) {
 		put_page(kpage);
-		return;
+		goto out_unlock;
 	}
 
 	remove_rmap_item_from_tree(rmap_item);
@@ -2080,22 +2214,44 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			stable_tree_append(rmap_item, page_stable_node(kpage),
 					   max_page_sharing_bypass);
 			unlock_page(kpage);
+			scan->nr_merged++;
 		}
 		put_page(kpage);
-		return;
+		goto out_unlock;
 	}
+	mutex_unlock(&ksm_tree_mutex);
 
 	/*
 	 * If the hash value of the page has changed from the last time
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
+	 *
+	 * A sample of the page is checked first. If that already changed
+	 * on the previous scan too, the page is volatile and hashing all
+	 * of it would be wasted; otherwise the full checksum is still
+	 * recorded, so that a page which settles down is merged on the
+	 * next scan as before.
 	 */
+	sample = calc_sample(page);
+	if (rmap_item->oldsample != sample) {
+		rmap_item->oldsample = sample;
+		scan->nr_volatile++;
+		if (rmap_item->address & VOLATILE_FLAG)
+			return;
+		rmap_item->address |= VOLATILE_FLAG;
+		rmap_item->oldchecksum = calc_checksum(page);
+		return;
+	}
+
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
+		rmap_item->address |= VOLATILE_FLAG;
+		scan->nr_volatile++;
 		return;
 	}
+	rmap_item->address &= ~VOLATILE_FLAG;
 
 	/*
 	 * Same checksum as an empty page. We attempt to merge it with the
@@ -2113,9 +2269,13 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		 * In case of failure, the page was not really empty, so we
 		 * need to continue. Otherwise we're done.
 		 */
-		if (!err)
+		if (!err) {
+			scan->nr_merged++;
 			return;
+		}
 	}
+
+	mutex_lock(&ksm_tree_mutex);
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
 	if (tree_rmap_item) {
@@ -2160,6 +2320,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			if (!stable_node) {
 				break_cow(tree_rmap_item);
 				break_cow(rmap_item);
+			} else {
+				scan->nr_merged++;
 			}
 		} else if (split) {
 			/*
@@ -2172,14 +2334,48 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			 * perhaps try again later.
 			 */
 			if (!trylock_page(page))
-				return;
+				goto out_unlock;
 			split_huge_page(page);
 			unlock_page(page);
 		}
 	}
+out_unlock:
+	mutex_unlock(&ksm_tree_mutex);
+}
+
+/*
+ * rmap_items dropped while a scanner holds mmap_sem are only unlinked from
+ * their mm_slot: ksm_tree_mutex must not be waited for under mmap_sem, as
+ * its holder may want the mmap_sem of any mm. They are removed from the
+ * trees and freed by flush_stale_rmap_items(), before the scanner's cursor
+ * leaves the mm_slot, so the mm they point to is still pinned meanwhile.
+ */
+static void defer_rmap_item_removal(struct ksm_scan *scan,
+				    struct rmap_item *rmap_item)
+{
+	rmap_item->rmap_list = scan->stale;
+	scan->stale = rmap_item;
+}
+
+static void flush_stale_rmap_items(struct ksm_scan *scan)
+{
+	struct rmap_item *rmap_item;
+
+	if (!scan->stale)
+		return;
+
+	mutex_lock(&ksm_tree_mutex);
+	while (scan->stale) {
+		rmap_item = scan->stale;
+		scan->stale = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+	mutex_unlock(&ksm_tree_mutex);
 }
 
-static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
+static struct rmap_item *get_next_rmap_item(struct ksm_scan *scan,
+					    struct mm_slot *mm_slot,
 					    struct rmap_item **rmap_list,
 					    unsigned long addr)
 {
@@ -2192,8 +2388,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		defer_rmap_item_removal(scan, rmap_item);
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -2207,31 +2402,34 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * All the scanners share the unstable tree, which is rebuilt on each full
+ * scan.  A full scan only completes, and the tree is only reset, once each
+ * scanner taking part has been right through its list of mm_slots: this
+ * keeps the age of any unstable rmap_item within one full scan.
+ */
+static bool ksm_start_pass(struct ksm_scan *scan)
 {
-	struct mm_struct *mm;
-	struct mm_slot *slot;
-	struct vm_area_struct *vma;
-	struct rmap_item *rmap_item;
-	int nid;
+	bool started = false;
 
-	if (list_empty(&ksm_mm_head.mm_list))
-		return NULL;
+	mutex_lock(&ksm_tree_mutex);
+	if (scan->pass != ksm_seqnr) {
+		scan->pass = ksm_seqnr;
+		ksm_pass_pending |= BIT(scan->id);
+		started = true;
+	}
+	mutex_unlock(&ksm_tree_mutex);
+	return started;
+}
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
-		/*
-		 * A number of pages can hang around indefinitely on per-cpu
-		 * pagevecs, raised page count preventing write_protect_page
-		 * from merging them.  Though it doesn't really matter much,
-		 * it is puzzling to see some stuck in pages_volatile until
-		 * other activity jostles them out, and they also prevented
-		 * LTP's KSM test from succeeding deterministically; so drain
-		 * them here (here rather than on entry to ksm_do_scan(),
-		 * so we don't IPI too often when pages_to_scan is set low).
-		 */
-		lru_add_drain_all();
+static void ksm_end_pass(struct ksm_scan *scan)
+{
+	bool completed = false;
+	int i, nid;
 
+	mutex_lock(&ksm_tree_mutex);
+	ksm_pass_pending &= ~BIT(scan->id);
+	if (!ksm_pass_pending) {
 		/*
 		 * Whereas stale stable_nodes on the stable_tree itself
 		 * get pruned in the regular course of stable_tree_search(),
@@ -2253,20 +2451,61 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 
 		for (nid = 0; nid < ksm_nr_node_ids; nid++)
 			root_unstable_tree[nid] = RB_ROOT;
+		ksm_seqnr++;
+
+		/* Every scanner with work has to take part in the next one */
+		spin_lock(&ksm_mmlist_lock);
+		for (i = 0; i < ksm_nr_scanners; i++)
+			if (!list_empty(&ksm_scans[i].mm_head.mm_list))
+				ksm_pass_pending |= BIT(i);
+		spin_unlock(&ksm_mmlist_lock);
+		completed = true;
+	}
+	mutex_unlock(&ksm_tree_mutex);
+
+	/*
+	 * A number of pages can hang around indefinitely on per-cpu
+	 * pagevecs, raised page count preventing write_protect_page
+	 * from merging them.  Though it doesn't really matter much,
+	 * it is puzzling to see some stuck in pages_volatile until
+	 * other activity jostles them out, and they also prevented
+	 * LTP's KSM test from succeeding deterministically; so drain
+	 * them here (here rather than on entry to ksm_do_scan(),
+	 * so we don't IPI too often when pages_to_scan is set low).
+	 */
+	if (completed)
+		lru_add_drain_all();
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *scan,
+						 struct page **page)
+{
+	struct mm_struct *mm;
+	struct mm_slot *slot;
+	struct vm_area_struct *vma;
+	struct rmap_item *rmap_item;
+
+	slot = scan->mm_slot;
+	if (slot == &scan->mm_head) {
+		/* Wait for the others to finish the current full scan */
+		if (!ksm_start_pass(scan))
+			return NULL;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/*
-		 * Although we tested list_empty() above, a racing __ksm_exit
-		 * of the last mm on the list may have removed it since then.
+		 * A racing __ksm_exit of the last mm on the list may have
+		 * removed it, or there may have been nothing to scan at all.
 		 */
-		if (slot == &ksm_mm_head)
+		if (slot == &scan->mm_head) {
+			ksm_end_pass(scan);
 			return NULL;
+		}
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -2274,59 +2513,61 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
-				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+				rmap_item = get_next_rmap_item(scan, slot,
+					scan->rmap_list, scan->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				flush_stale_rmap_items(scan);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	while (*scan->rmap_list) {
+		rmap_item = *scan->rmap_list;
+		*scan->rmap_list = rmap_item->rmap_list;
+		defer_rmap_item_removal(scan, rmap_item);
+	}
 
-	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
-						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -2336,79 +2577,135 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 * or when all VM_MERGEABLE areas have been unmapped (and
 		 * mmap_sem then protects against race with MADV_MERGEABLE).
 		 */
+		spin_lock(&ksm_mmlist_lock);
+		scan->mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
 		hash_del(&slot->link);
 		list_del(&slot->mm_list);
+		scan->nr_mm_slots--;
 		spin_unlock(&ksm_mmlist_lock);
 
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 		up_read(&mm->mmap_sem);
+		/* The rmap_items point to mm: drop them before mmdrop */
+		flush_stale_rmap_items(scan);
 		mmdrop(mm);
 	} else {
 		up_read(&mm->mmap_sem);
+		flush_stale_rmap_items(scan);
 		/*
-		 * up_read(&mm->mmap_sem) first because after
-		 * spin_unlock(&ksm_mmlist_lock) run, the "mm" may
-		 * already have been freed under us by __ksm_exit()
-		 * because the "mm_slot" is still hashed and
-		 * ksm_scan.mm_slot doesn't point to it anymore.
+		 * Only move the cursor on after that: once it no longer
+		 * points to the "mm_slot", the "mm" may be freed under us
+		 * by __ksm_exit() because the "mm_slot" is still hashed.
 		 */
+		spin_lock(&ksm_mmlist_lock);
+		scan->mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
 		spin_unlock(&ksm_mmlist_lock);
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = scan->mm_slot;
+	if (slot != &scan->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	ksm_end_pass(scan);
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @scan:  the cursor of the calling ksmd thread.
  * @scan_npages:  number of pages we want to scan before we return.
+ *
+ * Returns the number of pages scanned.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static unsigned int ksm_do_scan(struct ksm_scan *scan,
+				unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned int scanned = 0;
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scanned < scan_npages && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(scan, &page);
 		if (!rmap_item)
-			return;
-		cmp_and_merge_page(page, rmap_item);
+			break;
+		cmp_and_merge_page(scan, page, rmap_item);
 		put_page(page);
+		scanned++;
 	}
+	return scanned;
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_scan *scan)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) &&
+		(!list_empty(&scan->mm_head.mm_list) ||
+		 (READ_ONCE(ksm_pass_pending) & BIT(scan->id)));
 }
 
-static int ksm_scan_thread(void *nothing)
+/*
+ * Scanners which keep finding pages to merge come back sooner, those which
+ * mostly find volatile pages back off: by up to a factor of four either way
+ * from sleep_millisecs.
+ */
+#define KSM_SLEEP_SHIFT_MAX	2
+
+static unsigned int ksm_scan_sleep_millisecs(struct ksm_scan *scan,
+					     unsigned int scanned)
 {
+	unsigned int msecs = ksm_thread_sleep_millisecs;
+
+	if (!ksm_adaptive_scan) {
+		scan->sleep_shift = 0;
+	} else if (scanned) {
+		if (scan->nr_merged > scan->nr_volatile)
+			scan->sleep_shift = max(scan->sleep_shift - 1,
+						-KSM_SLEEP_SHIFT_MAX);
+		else if (scan->nr_volatile > scanned / 2)
+			scan->sleep_shift = min(scan->sleep_shift + 1,
+						KSM_SLEEP_SHIFT_MAX);
+	}
+	scan->nr_merged = 0;
+	scan->nr_volatile = 0;
+
+	if (scan->sleep_shift < 0)
+		return msecs >> -scan->sleep_shift;
+	return msecs << scan->sleep_shift;
+}
+
+static int ksm_scan_thread(void *data)
+{
+	struct ksm_scan *scan = data;
+	unsigned int scanned;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		if (ksm_run & KSM_RUN_OFFLINE) {
+			up_read(&ksm_thread_sem);
+			wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
+				    TASK_UNINTERRUPTIBLE);
+			continue;
+		}
+		scanned = 0;
+		if (ksmd_should_run(scan))
+			scanned = ksm_do_scan(scan, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
-			schedule_timeout_interruptible(
-				msecs_to_jiffies(ksm_thread_sleep_millisecs));
+		if (ksmd_should_run(scan)) {
+			schedule_timeout_interruptible(msecs_to_jiffies(
+				ksm_scan_sleep_millisecs(scan, scanned)));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(scan) || kthread_should_stop());
 		}
 	}
 	return 0;
@@ -2471,16 +2768,26 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 int __ksm_enter(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
+	struct ksm_scan *scan;
 	int needs_wakeup;
+	int i;
 
 	mm_slot = alloc_mm_slot();
 	if (!mm_slot)
 		return -ENOMEM;
 
+	spin_lock(&ksm_mmlist_lock);
+	/* Hand the mm to the scanner with the fewest mms to scan */
+	scan = &ksm_scans[0];
+	for (i = 1; i < ksm_nr_scanners; i++)
+		if (ksm_scans[i].nr_mm_slots < scan->nr_mm_slots)
+			scan = &ksm_scans[i];
+	mm_slot->scan = scan;
+	scan->nr_mm_slots++;
+
 	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	needs_wakeup = list_empty(&scan->mm_head.mm_list);
 
-	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
 	 * When KSM_RUN_MERGE (or KSM_RUN_STOP),
@@ -2493,9 +2800,9 @@ int __ksm_enter(struct mm_struct *mm)
 	 * missed: then we might as well insert at the end of the list.
 	 */
 	if (ksm_run & KSM_RUN_UNMERGE)
-		list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
+		list_add_tail(&mm_slot->mm_list, &scan->mm_head.mm_list);
 	else
-		list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+		list_add_tail(&mm_slot->mm_list, &scan->mm_slot->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -2523,14 +2830,15 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && mm_slot->scan->mm_slot != mm_slot) {
 		if (!mm_slot->rmap_list) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			mm_slot->scan->nr_mm_slots--;
 			easy_to_free = 1;
 		} else {
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &mm_slot->scan->mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -2666,16 +2974,6 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 #endif /* CONFIG_MIGRATION */
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
-static void wait_while_offlining(void)
-{
-	while (ksm_run & KSM_RUN_OFFLINE) {
-		mutex_unlock(&ksm_thread_mutex);
-		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
-			    TASK_UNINTERRUPTIBLE);
-		mutex_lock(&ksm_thread_mutex);
-	}
-}
-
 static bool stable_node_dup_remove_range(struct stable_node *stable_node,
 					 unsigned long start_pfn,
 					 unsigned long end_pfn)
@@ -2759,11 +3057,11 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * and remove_all_stable_nodes() while memory is going offline:
 		 * it is unsafe for them to touch the stable tree at this time.
 		 * But unmerge_ksm_pages(), rmap lookups and other entry points
-		 * which do not need the ksm_thread_mutex are all safe.
+		 * which do not need the ksm_thread_sem are all safe.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run |= KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
@@ -2779,9 +3077,9 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run &= ~KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 
 		smp_mb();	/* wake_up_bit advises this */
 		wake_up_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE));
@@ -2789,10 +3087,6 @@ static int ksm_memory_callback(struct notifier_block *self,
 	}
 	return NOTIFY_OK;
 }
-#else
-static void wait_while_offlining(void)
-{
-}
 #endif /* CONFIG_MEMORY_HOTREMOVE */
 
 #ifdef CONFIG_SYSFS
@@ -2800,6 +3094,22 @@ static void wait_while_offlining(void)
  * This all compiles without CONFIG_SYSFS, but is a waste of space.
  */
 
+#ifdef CONFIG_MEMORY_HOTREMOVE
+static void wait_while_offlining(void)
+{
+	while (ksm_run & KSM_RUN_OFFLINE) {
+		up_write(&ksm_thread_sem);
+		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
+			    TASK_UNINTERRUPTIBLE);
+		down_write(&ksm_thread_sem);
+	}
+}
+#else
+static void wait_while_offlining(void)
+{
+}
+#endif /* CONFIG_MEMORY_HOTREMOVE */
+
 #define KSM_ATTR_RO(_name) \
 	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
 #define KSM_ATTR(_name) \
@@ -2877,7 +3187,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_run != flags) {
 		ksm_run = flags;
@@ -2891,7 +3201,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -2920,7 +3230,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 	if (knob > 1)
 		return -EINVAL;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_merge_across_nodes != knob) {
 		if (ksm_pages_shared || remove_all_stable_nodes())
@@ -2951,7 +3261,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -2980,6 +3290,72 @@ static ssize_t use_zero_pages_store(struct kobject *kobj,
 }
 KSM_ATTR(use_zero_pages);
 
+static ssize_t checksum_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < KSM_CHECKSUM_NR; i++)
+		len += sprintf(buf + len, i == ksm_checksum_algo ?
+			       "[%s] " : "%s ", ksm_checksum_names[i]);
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static ssize_t checksum_store(struct kobject *kobj,
+			      struct kobj_attribute *attr,
+			      const char *buf, size_t count)
+{
+	int algo;
+
+	algo = sysfs_match_string(ksm_checksum_names, buf);
+	if (algo < 0)
+		return -EINVAL;
+
+	/*
+	 * Checksums recorded with the old digest just make their pages
+	 * look volatile for one more scan.
+	 */
+	down_write(&ksm_thread_sem);
+	ksm_checksum_algo = algo;
+	zero_checksum = calc_checksum(ZERO_PAGE(0));
+	up_write(&ksm_thread_sem);
+
+	return count;
+}
+KSM_ATTR(checksum);
+
+static ssize_t adaptive_scan_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_adaptive_scan);
+}
+static ssize_t adaptive_scan_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	bool value;
+
+	err = kstrtobool(buf, &value);
+	if (err)
+		return -EINVAL;
+
+	ksm_adaptive_scan = value;
+
+	return count;
+}
+KSM_ATTR(adaptive_scan);
+
+static ssize_t threads_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_scanners);
+}
+KSM_ATTR_RO(threads);
+
 static ssize_t max_page_sharing_show(struct kobject *kobj,
 				     struct kobj_attribute *attr, char *buf)
 {
@@ -3007,7 +3383,7 @@ static ssize_t max_page_sharing_store(struct kobject *kobj,
 	if (READ_ONCE(ksm_max_page_sharing) == knob)
 		return count;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_max_page_sharing != knob) {
 		if (ksm_pages_shared || remove_all_stable_nodes())
@@ -3015,7 +3391,7 @@ static ssize_t max_page_sharing_store(struct kobject *kobj,
 		else
 			ksm_max_page_sharing = knob;
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -3047,7 +3423,7 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items) - ksm_pages_shared
 				- ksm_pages_sharing - ksm_pages_unshared;
 	/*
 	 * It was not worth any locking to calculate that statistic,
@@ -3102,7 +3478,7 @@ KSM_ATTR(stable_node_chains_prune_millisecs);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
@@ -3123,6 +3499,9 @@ static struct attribute *ksm_attrs[] = {
 	&stable_node_dups_attr.attr,
 	&stable_node_chains_prune_millisecs_attr.attr,
 	&use_zero_pages_attr.attr,
+	&checksum_attr.attr,
+	&adaptive_scan_attr.attr,
+	&threads_attr.attr,
 	NULL,
 };
 
@@ -3134,8 +3513,9 @@ static const struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
-	int err;
+	struct task_struct *ksm_threads[KSM_MAX_SCANNERS];
+	unsigned int nr_threads;
+	int i, err;
 
 	/* The correct value depends on page size and endianness */
 	zero_checksum = calc_checksum(ZERO_PAGE(0));
@@ -3146,18 +3526,42 @@ static int __init ksm_init(void)
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
+	for (i = 0; i < KSM_MAX_SCANNERS; i++) {
+		struct ksm_scan *scan = &ksm_scans[i];
+
+		INIT_LIST_HEAD(&scan->mm_head.mm_list);
+		scan->mm_slot = &scan->mm_head;
+		scan->pass = ULONG_MAX;
+		scan->id = i;
+	}
+
+	nr_threads = ksm_threads_param ?: DIV_ROUND_UP(num_online_cpus(), 8);
+	nr_threads = clamp_t(unsigned int, nr_threads, 1, KSM_MAX_SCANNERS);
+	for (i = 0; i < nr_threads; i++) {
+		if (i)
+			ksm_threads[i] = kthread_run(ksm_scan_thread,
+						     &ksm_scans[i], "ksmd/%d", i);
+		else
+			ksm_threads[i] = kthread_run(ksm_scan_thread,
+						     &ksm_scans[i], "ksmd");
+		if (IS_ERR(ksm_threads[i]))
+			break;
+	}
+	if (!i) {
 		pr_err("ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+		err = PTR_ERR(ksm_threads[0]);
 		goto out_free;
 	}
+	if (i < nr_threads)
+		pr_warn("ksm: only created %d of %u kthreads\n", i, nr_threads);
+	ksm_nr_scanners = i;
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		for (i = 0; i < ksm_nr_scanners; i++)
+			kthread_stop(ksm_threads[i]);
 		goto out_free;
 	}
 #else
@@ -16,6 +16,7 @@
 #include <linux/falloc.h>
 #include <linux/sched.h>
 #include <linux/ksm.h>
+#include <linux/khugepaged.h>
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/blkdev.h>
@@ -127,6 +128,12 @@ static long madvise_behavior(struct vm_area_struct *vma,
 				error = -EAGAIN;
 			goto out;
 		}
+		/*
+		 * Collapse what is already populated in the advised range,
+		 * the collapse checks again whether the vma is suitable.
+		 */
+		if (new_flags & VM_HUGEPAGE)
+			khugepaged_hint(vma, start, end, true);
 		break;
 	}
 
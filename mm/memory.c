@@ -69,6 +69,9 @@
 #include <linux/userfaultfd_k.h>
 #include <linux/dax.h>
 #include <linux/oom.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 
 #include <asm/io.h>
 #include <asm/mmu_context.h>
@@ -198,7 +201,7 @@ static bool tlb_next_batch(struct mmu_gather *tlb)
 		return true;
 	}
 
-	if (tlb->batch_count == MAX_GATHER_BATCH_COUNT)
+	if (tlb->batch_count >= tlb->batch_limit)
 		return false;
 
 	batch = (void *)__get_free_pages(GFP_NOWAIT | __GFP_NOWARN, 0);
@@ -229,6 +232,7 @@ void arch_tlb_gather_mmu(struct mmu_gather *tlb, struct mm_struct *mm,
 	tlb->local.max  = ARRAY_SIZE(tlb->__pages);
 	tlb->active     = &tlb->local;
 	tlb->batch_count = 0;
+	tlb->batch_limit = MAX_GATHER_BATCH_COUNT;
 
 #ifdef CONFIG_HAVE_RCU_TABLE_FREE
 	tlb->batch = NULL;
@@ -238,6 +242,165 @@ void arch_tlb_gather_mmu(struct mmu_gather *tlb, struct mm_struct *mm,
 	__tlb_reset_range(tlb);
 }
 
+/*
+ * Releasing the pages dominates exit() and munmap() of a large address
+ * space.  Once the TLB has been flushed nothing can reach the gathered
+ * pages any more, so the page-sized batches are handed to a per-CPU
+ * worker and the unmapping task carries on with fresh ones.  While that
+ * works the gather is allowed to grow beyond MAX_GATHER_BATCH_COUNT.
+ *
+ * At most TLB_FREE_MAX_PAGES may be queued on a CPU, plus one oversized
+ * chain; past that, and for OOM victims whose memory is needed right
+ * away, the pages are freed synchronously again.  Reclaim and the OOM
+ * killer wait for the queued pages with tlb_free_flush().
+ */
+#define TLB_FREE_MAX_PAGES	(SZ_1G >> PAGE_SHIFT)
+
+struct tlb_free_queue {
+	spinlock_t		lock;
+	struct mmu_gather_batch	*head;
+	struct mmu_gather_batch	**tail;
+	unsigned long		nr_pages;
+	struct work_struct	work;
+};
+
+static DEFINE_PER_CPU(struct tlb_free_queue, tlb_free_queue);
+static struct workqueue_struct *tlb_free_wq __read_mostly;
+/* pages queued or being freed by the workers, across all CPUs */
+static atomic_long_t tlb_free_pending = ATOMIC_LONG_INIT(0);
+
+static void tlb_free_batches(struct mmu_gather_batch *batch)
+{
+	struct mmu_gather_batch *next;
+
+	for (; batch; batch = next) {
+		next = batch->next;
+		if (batch->nr)
+			free_pages_and_swap_cache(batch->pages, batch->nr);
+		free_pages((unsigned long)batch, 0);
+		cond_resched();
+	}
+}
+
+static void tlb_free_workfn(struct work_struct *work)
+{
+	struct tlb_free_queue *q =
+		container_of(work, struct tlb_free_queue, work);
+	struct mmu_gather_batch *batch;
+	unsigned long nr_pages;
+
+	for (;;) {
+		spin_lock(&q->lock);
+		batch = q->head;
+		nr_pages = q->nr_pages;
+		q->head = NULL;
+		q->tail = &q->head;
+		q->nr_pages = 0;
+		spin_unlock(&q->lock);
+
+		if (!batch)
+			break;
+
+		tlb_free_batches(batch);
+		atomic_long_sub(nr_pages, &tlb_free_pending);
+
+		/*
+		 * Push the freed pages out of the per-cpu lists so they can
+		 * merge into high order blocks in the buddy allocator.
+		 */
+		if (nr_pages >= MAX_GATHER_BATCH_COUNT * MAX_GATHER_BATCH)
+			drain_local_pages(NULL);
+	}
+}
+
+/*
+ * Hand the batches chained off tlb->local to the background worker, unless
+ * the caller has to free them itself.
+ */
+static void tlb_defer_free(struct mmu_gather *tlb)
+{
+	struct mmu_gather_batch *first = tlb->local.next, *last, *batch;
+	struct tlb_free_queue *q;
+	unsigned long nr_pages = 0;
+	bool oversized = tlb->batch_count > MAX_GATHER_BATCH_COUNT;
+	bool full;
+	int cpu;
+
+	if (!tlb_free_wq || !first || !first->nr)
+		return;
+	if (!oversized && mm_is_oom_victim(tlb->mm))
+		return;
+
+	for (batch = first; ; batch = batch->next) {
+		nr_pages += batch->nr;
+		last = batch;
+		if (!batch->next)
+			break;
+	}
+
+	cpu = raw_smp_processor_id();
+	q = per_cpu_ptr(&tlb_free_queue, cpu);
+	spin_lock(&q->lock);
+	if (!oversized && q->nr_pages >= TLB_FREE_MAX_PAGES) {
+		spin_unlock(&q->lock);
+		tlb->batch_limit = MAX_GATHER_BATCH_COUNT;
+		return;
+	}
+	*q->tail = first;
+	q->tail = &last->next;
+	q->nr_pages += nr_pages;
+	full = q->nr_pages >= TLB_FREE_MAX_PAGES;
+	atomic_long_add(nr_pages, &tlb_free_pending);
+	spin_unlock(&q->lock);
+
+	queue_work_on(cpu, tlb_free_wq, &q->work);
+
+	tlb->local.next = NULL;
+	tlb->batch_count = 0;
+	if (full || mm_is_oom_victim(tlb->mm))
+		tlb->batch_limit = MAX_GATHER_BATCH_COUNT;
+	else
+		tlb->batch_limit = min_t(unsigned int, tlb->batch_limit * 2,
+					 MAX_GATHER_BATCH_COUNT_DEFERRED);
+}
+
+/**
+ * tlb_free_flush - wait for the pages handed to the tlb_free workers
+ *
+ * Reclaim and the OOM killer call this so that memory which an unmap has
+ * already given up is back in the allocator before they decide that
+ * there is none left.  Returns true if any pages were pending.
+ */
+bool tlb_free_flush(void)
+{
+	int cpu;
+
+	if (!tlb_free_wq || !atomic_long_read(&tlb_free_pending))
+		return false;
+
+	for_each_possible_cpu(cpu)
+		flush_work(&per_cpu_ptr(&tlb_free_queue, cpu)->work);
+	return true;
+}
+
+static int __init tlb_free_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct tlb_free_queue *q = per_cpu_ptr(&tlb_free_queue, cpu);
+
+		spin_lock_init(&q->lock);
+		q->head = NULL;
+		q->tail = &q->head;
+		INIT_WORK(&q->work, tlb_free_workfn);
+	}
+
+	tlb_free_wq = alloc_workqueue("tlb_free", WQ_MEM_RECLAIM, 0);
+	return 0;
+}
+early_initcall(tlb_free_init);
+
 static void tlb_flush_mmu_free(struct mmu_gather *tlb)
 {
 	struct mmu_gather_batch *batch;
@@ -245,6 +408,8 @@ static void tlb_flush_mmu_free(struct mmu_gather *tlb)
 #ifdef CONFIG_HAVE_RCU_TABLE_FREE
 	tlb_table_flush(tlb);
 #endif
+	tlb_defer_free(tlb);
+
 	for (batch = &tlb->local; batch && batch->nr; batch = batch->next) {
 		free_pages_and_swap_cache(batch->pages, batch->nr);
 		batch->nr = 0;
@@ -312,6 +477,14 @@ bool __tlb_remove_page_size(struct mmu_gather *tlb, struct page *page, int page_
 	return false;
 }
 
+#else /* !HAVE_GENERIC_MMU_GATHER */
+
+/* Architectures with their own mmu_gather free their pages inline. */
+bool tlb_free_flush(void)
+{
+	return false;
+}
+
 #endif /* HAVE_GENERIC_MMU_GATHER */
 
 #ifdef CONFIG_HAVE_RCU_TABLE_FREE
@@ -4691,21 +4864,124 @@ static inline void process_huge_page(
 	}
 }
 
-static void clear_gigantic_page(struct page *page,
-				unsigned long addr,
-				unsigned int pages_per_huge_page)
+/*
+ * Gigantic pages are too large to be processed by a single CPU in
+ * reasonable time: clearing a 1GB page takes a good part of a second.
+ * Split the work into chunks of at least GIGANTIC_CHUNK_PAGES subpages and
+ * hand all but one of them to the unbound workqueue, so that idle CPUs
+ * help while the faulting task processes the last chunk itself.
+ */
+#define GIGANTIC_CHUNK_PAGES	(SZ_32M >> PAGE_SHIFT)
+
+/*
+ * vm.huge_page_copy_chunk_kb: chunk size in KB for copy-on-write of
+ * gigantic pages, 0 to 1048576 (1GB), default 32768.  A gigantic page of
+ * at least two chunks is copied in parallel; 0 copies it in the faulting
+ * task.  Pages up to MAX_ORDER are always copied by the faulting task,
+ * target subpage last.
+ */
+int sysctl_huge_page_copy_chunk_kb __read_mostly = SZ_32M >> 10;
+
+struct gigantic_job {
+	struct page *dst;
+	struct page *src;
+	unsigned long addr;
+	struct vm_area_struct *vma;
+	void (*fn)(struct gigantic_job *job, unsigned int start,
+		   unsigned int nr);
+	atomic_t pending;
+	struct completion done;
+};
+
+struct gigantic_chunk {
+	struct work_struct work;
+	struct gigantic_job *job;
+	unsigned int start;
+	unsigned int nr;
+};
+
+static void gigantic_chunk_fn(struct work_struct *work)
 {
-	int i;
-	struct page *p = page;
+	struct gigantic_chunk *chunk =
+		container_of(work, struct gigantic_chunk, work);
+	struct gigantic_job *job = chunk->job;
+
+	job->fn(job, chunk->start, chunk->nr);
+	if (atomic_dec_and_test(&job->pending))
+		complete(&job->done);
+}
+
+static void process_gigantic_page(struct gigantic_job *job,
+				  unsigned int pages_per_huge_page,
+				  unsigned int chunk_pages)
+{
+	struct gigantic_chunk *chunks;
+	unsigned int nr_chunks, per_chunk, start, i;
 
 	might_sleep();
-	for (i = 0; i < pages_per_huge_page;
-	     i++, p = mem_map_next(p, page, i)) {
+
+	nr_chunks = min_t(unsigned int, num_online_cpus(),
+			  pages_per_huge_page / chunk_pages);
+	if (nr_chunks > 1) {
+		/*
+		 * Rounding per_chunk up can leave fewer chunks than asked
+		 * for, make sure every queued chunk ends inside the page.
+		 */
+		per_chunk = DIV_ROUND_UP(pages_per_huge_page, nr_chunks);
+		nr_chunks = DIV_ROUND_UP(pages_per_huge_page, per_chunk);
+	}
+	chunks = nr_chunks > 1 ?
+		kmalloc_array(nr_chunks - 1, sizeof(*chunks),
+			      GFP_KERNEL | __GFP_NOWARN) : NULL;
+	if (!chunks) {
+		job->fn(job, 0, pages_per_huge_page);
+		return;
+	}
+
+	atomic_set(&job->pending, nr_chunks - 1);
+	init_completion(&job->done);
+
+	for (i = 0, start = 0; i < nr_chunks - 1; i++, start += per_chunk) {
+		chunks[i].job = job;
+		chunks[i].start = start;
+		chunks[i].nr = per_chunk;
+		INIT_WORK(&chunks[i].work, gigantic_chunk_fn);
+		queue_work(system_unbound_wq, &chunks[i].work);
+	}
+
+	/* the faulting task takes the remainder */
+	job->fn(job, start, pages_per_huge_page - start);
+
+	wait_for_completion(&job->done);
+	kfree(chunks);
+}
+
+static void clear_gigantic_chunk(struct gigantic_job *job,
+				 unsigned int start, unsigned int nr)
+{
+	struct page *p = nth_page(job->dst, start);
+	unsigned int i;
+
+	/* mem_map_next() needs the index from the head of the page */
+	for (i = 0; i < nr; i++, p = mem_map_next(p, job->dst, start + i)) {
 		cond_resched();
-		clear_user_highpage(p, addr + i * PAGE_SIZE);
+		clear_user_highpage(p, job->addr + (start + i) * PAGE_SIZE);
 	}
 }
 
+static void clear_gigantic_page(struct page *page,
+				unsigned long addr,
+				unsigned int pages_per_huge_page)
+{
+	struct gigantic_job job = {
+		.dst = page,
+		.addr = addr,
+		.fn = clear_gigantic_chunk,
+	};
+
+	process_gigantic_page(&job, pages_per_huge_page, GIGANTIC_CHUNK_PAGES);
+}
+
 static void clear_subpage(unsigned long addr, int idx, void *arg)
 {
 	struct page *page = arg;
@@ -4727,25 +5003,41 @@ void clear_huge_page(struct page *page,
 	process_huge_page(addr_hint, pages_per_huge_page, clear_subpage, page);
 }
 
-static void copy_user_gigantic_page(struct page *dst, struct page *src,
-				    unsigned long addr,
-				    struct vm_area_struct *vma,
-				    unsigned int pages_per_huge_page)
+static void copy_huge_chunk(struct gigantic_job *job,
+			    unsigned int start, unsigned int nr)
 {
-	int i;
-	struct page *dst_base = dst;
-	struct page *src_base = src;
+	struct page *dst = nth_page(job->dst, start);
+	struct page *src = nth_page(job->src, start);
+	unsigned int i;
 
-	for (i = 0; i < pages_per_huge_page; ) {
+	for (i = 0; i < nr; ) {
 		cond_resched();
-		copy_user_highpage(dst, src, addr + i*PAGE_SIZE, vma);
+		copy_user_highpage(dst, src, job->addr + (start + i) * PAGE_SIZE,
+				   job->vma);
 
 		i++;
-		dst = mem_map_next(dst, dst_base, i);
-		src = mem_map_next(src, src_base, i);
+		dst = mem_map_next(dst, job->dst, start + i);
+		src = mem_map_next(src, job->src, start + i);
 	}
 }
 
+static void copy_user_gigantic_page(struct page *dst, struct page *src,
+				    unsigned long addr,
+				    struct vm_area_struct *vma,
+				    unsigned int pages_per_huge_page,
+				    unsigned int chunk_pages)
+{
+	struct gigantic_job job = {
+		.dst = dst,
+		.src = src,
+		.addr = addr,
+		.vma = vma,
+		.fn = copy_huge_chunk,
+	};
+
+	process_gigantic_page(&job, pages_per_huge_page, chunk_pages);
+}
+
 struct copy_subpage_arg {
 	struct page *dst;
 	struct page *src;
@@ -4771,10 +5063,15 @@ void copy_user_huge_page(struct page *dst, struct page *src,
 		.src = src,
 		.vma = vma,
 	};
+	unsigned int chunk_pages;
 
 	if (unlikely(pages_per_huge_page > MAX_ORDER_NR_PAGES)) {
+		chunk_pages = READ_ONCE(sysctl_huge_page_copy_chunk_kb) >>
+			      (PAGE_SHIFT - 10);
+		if (!chunk_pages || pages_per_huge_page < 2 * chunk_pages)
+			chunk_pages = pages_per_huge_page;
 		copy_user_gigantic_page(dst, src, addr, vma,
-					pages_per_huge_page);
+					pages_per_huge_page, chunk_pages);
 		return;
 	}
 
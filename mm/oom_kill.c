@@ -1072,6 +1072,9 @@ bool out_of_memory(struct oom_control *oc)
 		if (freed > 0)
 			/* Got some memory back in the last second. */
 			return true;
+		/* Unmapped pages were still waiting to be freed. */
+		if (tlb_free_flush())
+			return true;
 	}
 
 	/*
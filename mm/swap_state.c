@@ -39,6 +39,14 @@ static const struct address_space_operations swap_aops = {
 struct address_space *swapper_spaces[MAX_SWAPFILES] __read_mostly;
 static unsigned int nr_swapper_spaces[MAX_SWAPFILES] __read_mostly;
 static bool enable_vma_readahead __read_mostly = true;
+/*
+ * Readahead from a synchronous device like zram mostly decompresses pages
+ * that are never used, while a single page is as cheap to read there as
+ * a batch. Its window is capped to 1 << sync_ra_order pages instead of
+ * 1 << page_cluster. /sys/kernel/mm/swap/sync_ra_order takes 0 (default,
+ * no readahead) to SWAP_RA_ORDER_CEILING.
+ */
+static unsigned int swap_sync_ra_order __read_mostly;
 
 #define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
 #define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
@@ -93,8 +101,6 @@ unsigned long total_swapcache_pages(void)
 	return ret;
 }
 
-static atomic_t swapin_readahead_hits = ATOMIC_INIT(4);
-
 void show_swap_cache_info(void)
 {
 	printk("%lu pages in swap cache\n", total_swapcache_pages());
@@ -324,6 +330,16 @@ static inline bool swap_use_vma_readahead(void)
 	return READ_ONCE(enable_vma_readahead) && !atomic_read(&nr_rotate_swap);
 }
 
+/* The largest readahead window for @si is 1 << swap_ra_order(si) pages */
+static unsigned int swap_ra_order(struct swap_info_struct *si)
+{
+	unsigned int order = READ_ONCE(page_cluster);
+
+	if (si->flags & SWP_SYNCHRONOUS_IO)
+		order = min(order, READ_ONCE(swap_sync_ra_order));
+	return order;
+}
+
 /*
  * Lookup a swap entry in the swap cache. A found page will be returned
  * unlocked and with its refcount incremented - we rely on the kernel
@@ -367,7 +383,7 @@ struct page *lookup_swap_cache(swp_entry_t entry, struct vm_area_struct *vma,
 		if (readahead) {
 			count_vm_event(SWAP_RA_HIT);
 			if (!vma || !vma_ra)
-				atomic_inc(&swapin_readahead_hits);
+				atomic_inc(&swp_swap_info(entry)->ra_hits);
 		}
 	}
 
@@ -525,22 +541,21 @@ static unsigned int __swapin_nr_pages(unsigned long prev_offset,
 	return pages;
 }
 
-static unsigned long swapin_nr_pages(unsigned long offset)
+static unsigned long swapin_nr_pages(struct swap_info_struct *si,
+				     unsigned long offset)
 {
-	static unsigned long prev_offset;
 	unsigned int hits, pages, max_pages;
-	static atomic_t last_readahead_pages;
 
-	max_pages = 1 << READ_ONCE(page_cluster);
+	max_pages = 1 << swap_ra_order(si);
 	if (max_pages <= 1)
 		return 1;
 
-	hits = atomic_xchg(&swapin_readahead_hits, 0);
-	pages = __swapin_nr_pages(prev_offset, offset, hits, max_pages,
-				  atomic_read(&last_readahead_pages));
+	hits = atomic_xchg(&si->ra_hits, 0);
+	pages = __swapin_nr_pages(si->ra_prev_offset, offset, hits, max_pages,
+				  atomic_read(&si->ra_win));
 	if (!hits)
-		prev_offset = offset;
-	atomic_set(&last_readahead_pages, pages);
+		si->ra_prev_offset = offset;
+	atomic_set(&si->ra_win, pages);
 
 	return pages;
 }
@@ -577,7 +592,7 @@ struct page *swap_cluster_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	struct vm_area_struct *vma = vmf->vma;
 	unsigned long addr = vmf->address;
 
-	mask = swapin_nr_pages(offset) - 1;
+	mask = swapin_nr_pages(si, offset) - 1;
 	if (!mask)
 		goto skip;
 
@@ -661,7 +676,7 @@ static inline void swap_ra_clamp_pfn(struct vm_area_struct *vma,
 		    PFN_DOWN((faddr & PMD_MASK) + PMD_SIZE));
 }
 
-static void swap_ra_info(struct vm_fault *vmf,
+static void swap_ra_info(struct vm_fault *vmf, struct swap_info_struct *si,
 			struct vma_swap_readahead *ra_info)
 {
 	struct vm_area_struct *vma = vmf->vma;
@@ -675,7 +690,7 @@ static void swap_ra_info(struct vm_fault *vmf,
 	pte_t *tpte;
 #endif
 
-	max_win = 1 << min_t(unsigned int, READ_ONCE(page_cluster),
+	max_win = 1 << min_t(unsigned int, swap_ra_order(si),
 			     SWAP_RA_ORDER_CEILING);
 	if (max_win == 1) {
 		ra_info->win = 1;
@@ -741,7 +756,7 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 	bool page_allocated;
 	struct vma_swap_readahead ra_info = {0,};
 
-	swap_ra_info(vmf, &ra_info);
+	swap_ra_info(vmf, swp_swap_info(fentry), &ra_info);
 	if (ra_info.win == 1)
 		goto skip;
 
@@ -819,8 +834,30 @@ static struct kobj_attribute vma_ra_enabled_attr =
 	__ATTR(vma_ra_enabled, 0644, vma_ra_enabled_show,
 	       vma_ra_enabled_store);
 
+static ssize_t sync_ra_order_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", swap_sync_ra_order);
+}
+static ssize_t sync_ra_order_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	unsigned int order;
+
+	if (kstrtouint(buf, 10, &order) || order > SWAP_RA_ORDER_CEILING)
+		return -EINVAL;
+
+	WRITE_ONCE(swap_sync_ra_order, order);
+
+	return count;
+}
+static struct kobj_attribute sync_ra_order_attr =
+	__ATTR(sync_ra_order, 0644, sync_ra_order_show, sync_ra_order_store);
+
 static struct attribute *swap_attrs[] = {
 	&vma_ra_enabled_attr.attr,
+	&sync_ra_order_attr.attr,
 	NULL,
 };
 
@@ -2869,6 +2869,10 @@ static struct swap_info_struct *alloc_swap_info(void)
 	spin_unlock(&swap_lock);
 	spin_lock_init(&p->lock);
 	spin_lock_init(&p->cont_lock);
+	/* Initial readahead hits is 4 to start up with a small window */
+	atomic_set(&p->ra_hits, 4);
+	atomic_set(&p->ra_win, 0);
+	p->ra_prev_offset = 0;
 
 	return p;
 }
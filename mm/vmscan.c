@@ -3004,6 +3004,9 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 	pg_data_t *last_pgdat;
 	struct zoneref *z;
 	struct zone *zone;
+
+	/* let pages that an unmap queued for freeing reach the allocator */
+	tlb_free_flush();
 retry:
 	delayacct_freepages_start();
 